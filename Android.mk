@@ -20,8 +20,15 @@ LOCAL_MODULE    := libhev-lib
 LOCAL_SRC_FILES := \
 	src/hev-async-queue.c \
 	src/hev-event-loop.c \
+	src/hev-event-loop-runtime.c \
+	src/hev-event-loop-trace.c \
+	src/hev-event-loop-uring.c \
+	src/hev-event-loop-watchdog.c \
+	src/hev-event-source-datagram.c \
 	src/hev-event-source-fds.c \
 	src/hev-event-source-idle.c \
+	src/hev-event-source-listener.c \
+	src/hev-event-source-relay.c \
 	src/hev-event-source-signal.c \
 	src/hev-event-source-timeout.c \
 	src/hev-event-source.c \
@@ -31,6 +38,7 @@ LOCAL_SRC_FILES := \
 	src/hev-queue.c \
 	src/hev-ring-buffer.c \
 	src/hev-slist.c \
+	src/hev-timer-wheel.c \
 	src/hev-hash-table.c
 ifeq ($(TARGET_ARCH_ABI),armeabi-v7a)
 LOCAL_CFLAGS += -mfpu=neon
@@ -0,0 +1,230 @@
+/*
+ ============================================================================
+ Name        : datagram-echo.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2013 everyone.
+ Description : UDP echo server example and packet rate benchmark
+ ============================================================================
+ */
+
+#define _GNU_SOURCE
+#include <hev-lib.h>
+#include <stdio.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define BENCH_SECONDS	(2)
+#define BENCH_WINDOW	(64)
+#define BENCH_SIZE	(64)
+
+static uint64_t packets = 0;
+static volatile bool bench_quit = false;
+
+/* Echoes each datagram, or each segment of a GRO one, back to its peer. */
+static bool
+echo_handler (HevEventSource *source, HevEventSourceDatagramMsg *msgs,
+			unsigned int count, void *data)
+{
+	unsigned int i = 0;
+
+	for (i=0; i<count; i++) {
+		HevEventSourceDatagramMsg *msg = &msgs[i];
+		size_t size = msg->segment_size ? msg->segment_size : msg->len;
+		size_t offset = 0;
+
+		/* empty datagrams too */
+		do {
+			size_t len = msg->len - offset;
+
+			if (len > size)
+			  len = size;
+			hev_event_source_datagram_send (source, (uint8_t *) msg->data + offset,
+						len, (struct sockaddr *) &msg->addr, msg->addr_len);
+			offset += len;
+			packets ++;
+		} while (offset < msg->len);
+	}
+
+	return true;
+}
+
+static bool
+signal_int_handler (void *data)
+{
+	HevEventLoop *loop = data;
+
+	printf ("Quiting...\n");
+	hev_event_loop_quit (loop);
+
+	return true;
+}
+
+static int
+socket_new (struct sockaddr_in *addr)
+{
+	socklen_t addr_len = sizeof (*addr);
+	int fd, size = 4 * 1024 * 1024;
+
+	fd = socket (AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (0 > fd)
+	  return -1;
+	/* bursts of the window, not to be dropped */
+	setsockopt (fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof (size));
+	setsockopt (fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof (size));
+	if ((0 > bind (fd, (struct sockaddr *) addr, sizeof (*addr))) ||
+		(0 > getsockname (fd, (struct sockaddr *) addr, &addr_len))) {
+		close (fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Keeps a window of datagrams in flight, counting the echoes. */
+static void *
+client_thread_handler (void *data)
+{
+	struct sockaddr_in *server_addr = data;
+	struct mmsghdr msgs[BENCH_WINDOW];
+	struct iovec iovs[BENCH_WINDOW];
+	uint8_t bufs[BENCH_WINDOW][BENCH_SIZE];
+	struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 };
+	unsigned int i = 0;
+	int fd;
+
+	fd = socket (AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+	connect (fd, (struct sockaddr *) server_addr, sizeof (*server_addr));
+
+	memset (bufs, 'x', sizeof (bufs));
+	memset (msgs, 0, sizeof (msgs));
+	for (i=0; i<BENCH_WINDOW; i++) {
+		iovs[i].iov_base = bufs[i];
+		iovs[i].iov_len = BENCH_SIZE;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while (!bench_quit) {
+		int sent = sendmmsg (fd, msgs, BENCH_WINDOW, 0);
+		int received = 0;
+
+		/* lost ones time out, the window starts over */
+		while ((0 < sent) && (received < sent) && !bench_quit) {
+			int res = recvmmsg (fd, msgs, sent - received, MSG_WAITFORONE, NULL);
+			if (0 >= res)
+			  break;
+			received += res;
+		}
+	}
+
+	close (fd);
+
+	return NULL;
+}
+
+static void
+bench (unsigned int batch, unsigned int clients)
+{
+	pthread_t threads[clients];
+	struct sockaddr_in addr;
+	HevEventLoop *loop = NULL;
+	HevEventSource *source = NULL;
+	struct timespec begin, end;
+	unsigned int i = 0;
+	double seconds;
+	int fd;
+
+	memset (&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr ("127.0.0.1");
+	fd = socket_new (&addr);
+	if (0 > fd)
+	  exit (1);
+
+	loop = hev_event_loop_new ();
+	source = hev_event_source_datagram_new (fd, batch, 0);
+	hev_event_source_set_callback (source, (HevEventSourceFunc) echo_handler, NULL, NULL);
+	hev_event_loop_add_source (loop, source);
+	hev_event_source_unref (source);
+
+	packets = 0;
+	bench_quit = false;
+	for (i=0; i<clients; i++)
+	  pthread_create (&threads[i], NULL, client_thread_handler, &addr);
+
+	clock_gettime (CLOCK_MONOTONIC, &begin);
+	do {
+		hev_event_loop_iterate (loop, true);
+		clock_gettime (CLOCK_MONOTONIC, &end);
+	} while ((end.tv_sec - begin.tv_sec) < BENCH_SECONDS);
+
+	bench_quit = true;
+	for (i=0; i<clients; i++)
+	  pthread_join (threads[i], NULL);
+	hev_event_loop_unref (loop);
+	close (fd);
+
+	seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+	printf ("%10u %10u %14.0f\n", batch, clients, packets / seconds);
+}
+
+int
+main (int argc, char *argv[])
+{
+	HevEventLoop *loop = NULL;
+	HevEventSource *source = NULL;
+	struct sockaddr_in addr;
+	int fd = -1;
+
+	/* datagram-echo bench: batch 1 as with recvfrom, then batched */
+	if ((1 < argc) && (0 == strcmp (argv[1], "bench"))) {
+		unsigned int clients = 1;
+
+		printf ("%10s %10s %14s\n", "batch", "clients", "packets/s");
+		for (clients=1; clients<=4; clients*=2) {
+			bench (1, clients);
+			bench (HEV_EVENT_SOURCE_DATAGRAM_BATCH, clients);
+		}
+		return 0;
+	}
+
+	memset (&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr ("0.0.0.0");
+	addr.sin_port = htons (8000);
+	fd = socket_new (&addr);
+	if (0 > fd)
+	  exit (1);
+
+	loop = hev_event_loop_new ();
+
+	source = hev_event_source_datagram_new (fd, 0, 65536);
+	hev_event_source_set_name (source, "echo");
+	/* coalesced on the way in, split again by GSO on the way out */
+	hev_event_source_datagram_set_gro (source, true);
+	hev_event_source_set_callback (source, (HevEventSourceFunc) echo_handler, NULL, NULL);
+	hev_event_loop_add_source (loop, source);
+	hev_event_source_unref (source);
+
+	source = hev_event_source_signal_new (SIGINT);
+	hev_event_source_set_priority (source, 3);
+	hev_event_source_set_callback (source, signal_int_handler, loop, NULL);
+	hev_event_loop_add_source (loop, source);
+	hev_event_source_unref (source);
+
+	hev_event_loop_run (loop);
+
+	hev_event_loop_unref (loop);
+	close (fd);
+
+	return 0;
+}
+
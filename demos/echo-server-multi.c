@@ -0,0 +1,340 @@
+/*
+ ============================================================================
+ Name        : echo-server-multi.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2013 everyone.
+ Description : Echo server example, one event loop per core
+ ============================================================================
+ */
+
+#define _GNU_SOURCE
+#include <hev-lib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* connections accepted per dispatch of the listener */
+#define ACCEPT_BATCH	(64)
+
+typedef struct _Client Client;
+
+struct _Client
+{
+	HevEventSourceFD *fd;
+	HevRingBuffer *buffer;
+	bool idle;
+
+	Client *prev;
+	Client *next;
+};
+
+/* every loop thread has its own clients */
+static __thread Client *client_list = NULL;
+static __thread HevEventSource *client_source = NULL;
+static HevEventLoopRuntime *runtime = NULL;
+
+static Client *
+client_new (void)
+{
+	Client *client = HEV_MEMORY_ALLOCATOR_ALLOC (sizeof (Client));
+	if (client) {
+		client->fd = NULL;
+		client->buffer = NULL;
+		client->idle = false;
+		client->prev = NULL;
+		client->next = NULL;
+	}
+
+	return client;
+}
+
+static void
+client_list_add (Client *client)
+{
+	client->prev = NULL;
+	client->next = client_list;
+	if (client_list)
+	  client_list->prev = client;
+	client_list = client;
+}
+
+static void
+client_list_del (Client *client)
+{
+	if (client->prev)
+	  client->prev->next = client->next;
+	else
+	  client_list = client->next;
+	if (client->next)
+	  client->next->prev = client->prev;
+}
+
+static void
+client_free (Client *client)
+{
+	if (client) {
+		close (client->fd->fd);
+		hev_event_source_remove_fd (client->fd->source, client->fd);
+		hev_ring_buffer_unref (client->buffer);
+		HEV_MEMORY_ALLOCATOR_FREE (client);
+	}
+}
+
+static ssize_t
+read_data (int fd, HevRingBuffer *buffer)
+{
+	struct msghdr mh;
+	struct iovec iovec[2];
+	size_t iovec_len = 0, inc_len = 0;
+	ssize_t size = -2;
+
+	iovec_len = hev_ring_buffer_writing (buffer, iovec);
+	if (0 < iovec_len) {
+		/* recv data */
+		memset (&mh, 0, sizeof (mh));
+		mh.msg_iov = iovec;
+		mh.msg_iovlen = iovec_len;
+		size = recvmsg (fd, &mh, 0);
+		inc_len = (0 > size) ? 0 : size;
+		hev_ring_buffer_write_finish (buffer, inc_len);
+	}
+
+	return size;
+}
+
+static ssize_t
+write_data (int fd, HevRingBuffer *buffer)
+{
+	struct msghdr mh;
+	struct iovec iovec[2];
+	size_t iovec_len = 0, inc_len = 0;
+	ssize_t size = -2;
+
+	iovec_len = hev_ring_buffer_reading (buffer, iovec);
+	if (0 < iovec_len) {
+		/* send data */
+		memset (&mh, 0, sizeof (mh));
+		mh.msg_iov = iovec;
+		mh.msg_iovlen = iovec_len;
+		size = sendmsg (fd, &mh, 0);
+		inc_len = (0 > size) ? 0 : size;
+		hev_ring_buffer_read_finish (buffer, inc_len);
+	}
+
+	return size;
+}
+
+static bool
+client_source_handler (HevEventSourceFD *fd, void *data)
+{
+	Client *client = NULL;
+	ssize_t size = 0;
+	bool trywrite = false;
+
+	client = hev_event_source_fd_get_data (fd);
+
+	if (EPOLLIN & fd->revents) {
+		size = read_data (fd->fd, client->buffer);
+		if (-2 < size) {
+			if (-1 == size) {
+				if (EAGAIN == errno)
+				  fd->revents &= ~EPOLLIN;
+				else
+				  goto remove_client;
+			} else if (0 == size) {
+				goto remove_client;
+			}
+		}
+		/* activate try write */
+		trywrite = true;
+	}
+
+	if ((EPOLLOUT & fd->revents) || trywrite ) {
+		/* try write */
+		size = write_data (fd->fd, client->buffer);
+		if (-2 < size) {
+			if (-1 == size) {
+				if (EAGAIN != errno)
+				  goto remove_client;
+			}
+		} else {
+			fd->revents &= ~EPOLLOUT;
+		}
+	}
+
+	if ((EPOLLERR | EPOLLHUP) & fd->revents)
+	  goto remove_client;
+
+	client->idle = false;
+
+	return true;
+
+remove_client:
+	/* printf ("Client %d leave\n", fd->fd); */
+	client_list_del (client);
+	client_free (client);
+
+	return true;
+}
+
+static bool
+listener_source_handler (HevEventSourceFD *fd, void *data)
+{
+	unsigned int i = 0;
+
+	/* a batch per dispatch, the clients get their turn in between; with a
+	 * shared listener, EAGAIN is also another loop taking the connection */
+	for (i=0; i<ACCEPT_BATCH; i++) {
+		struct sockaddr_in addr;
+		socklen_t addr_len;
+		Client *client = NULL;
+		int client_fd = 0;
+
+		addr_len = sizeof (addr);
+		client_fd = accept4 (fd->fd, (struct sockaddr *) &addr,
+					&addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (0 > client_fd) {
+			if (EAGAIN == errno)
+			  fd->revents &= ~EPOLLIN;
+			else
+			  printf ("Accept failed!\n");
+			break;
+		}
+
+		client = client_new ();
+		client->buffer = hev_ring_buffer_new (1024);
+		/* printf ("New client %d enter from %s:%u\n",
+			client_fd, inet_ntoa (addr.sin_addr), ntohs (addr.sin_port)); */
+		client->fd = hev_event_source_add_fd (client_source, client_fd, EPOLLIN | EPOLLOUT | EPOLLET);
+		hev_event_source_fd_set_data (client->fd, client);
+		client_list_add (client);
+	}
+
+	return true;
+}
+
+static bool
+timeout_handler (void *data)
+{
+	Client *client = NULL, *next = NULL;
+	for (client=client_list; client; client=next) {
+		next = client->next;
+		if (client->idle) {
+			/* printf ("Remove timeout client %d\n", client->fd->fd); */
+			client_list_del (client);
+			client_free (client);
+		} else {
+			client->idle = true;
+		}
+	}
+	return true;
+}
+
+static bool
+signal_int_handler (void *data)
+{
+	printf ("Quiting...\n");
+	hev_event_loop_runtime_quit (runtime);
+
+	return true;
+}
+
+static void
+loop_init (HevEventLoop *loop, unsigned int index, void *data)
+{
+	HevEventSource *source = NULL;
+
+	client_source = hev_event_source_fds_new ();
+	hev_event_source_set_callback (client_source,
+				(HevEventSourceFunc) client_source_handler, NULL, NULL);
+	hev_event_loop_add_source (loop, client_source);
+	hev_event_source_unref (client_source);
+
+	source = hev_event_source_timeout_new (30 * 1000);
+	hev_event_source_set_priority (source, 1);
+	hev_event_source_set_callback (source, timeout_handler, NULL, NULL);
+	hev_event_loop_add_source (loop, source);
+	hev_event_source_unref (source);
+
+	/* signals are blocked on all threads, the first loop takes them */
+	if (0 == index) {
+		source = hev_event_source_signal_new (SIGINT);
+		hev_event_source_set_priority (source, 3);
+		hev_event_source_set_callback (source, signal_int_handler, NULL, NULL);
+		hev_event_loop_add_source (loop, source);
+		hev_event_source_unref (source);
+	}
+}
+
+static void
+loop_fini (HevEventLoop *loop, unsigned int index, void *data)
+{
+	Client *client = NULL;
+
+	while (client_list) {
+		client = client_list;
+		client_list_del (client);
+		client_free (client);
+	}
+}
+
+int
+main (int argc, char *argv[])
+{
+	struct sockaddr_in addr;
+	unsigned int count = 0;
+	bool shared = false;
+	sigset_t mask;
+
+	/* echo-server-multi [count] [shared] */
+	if (1 < argc)
+	  count = strtoul (argv[1], NULL, 10);
+	if (2 < argc)
+	  shared = (0 == strcmp (argv[2], "shared"));
+
+	/* block before any loop thread exists, they inherit the mask */
+	sigemptyset (&mask);
+	sigaddset (&mask, SIGINT);
+	sigaddset (&mask, SIGPIPE);
+	pthread_sigmask (SIG_BLOCK, &mask, NULL);
+
+	runtime = hev_event_loop_runtime_new (count, loop_init, loop_fini, NULL);
+	if (!runtime)
+	  exit (1);
+
+	memset (&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr ("0.0.0.0");
+	addr.sin_port = htons (8000);
+	/* a socket per loop by default, or one for all woken exclusively */
+	if (shared) {
+		if (!hev_event_loop_runtime_add_shared_listener (runtime,
+						(struct sockaddr *) &addr, sizeof (addr), 1024,
+						listener_source_handler, NULL))
+		  exit (3);
+	} else {
+		if (!hev_event_loop_runtime_add_listener (runtime,
+						(struct sockaddr *) &addr, sizeof (addr), 1024,
+						listener_source_handler, NULL))
+		  exit (3);
+	}
+
+	printf ("Running %u loops\n", hev_event_loop_runtime_get_count (runtime));
+	if (!hev_event_loop_runtime_run (runtime)) {
+		printf ("Loops failed, is port 8000 taken?\n");
+		exit (2);
+	}
+
+	hev_event_loop_runtime_unref (runtime);
+
+	return 0;
+}
+
@@ -7,20 +7,22 @@
  ============================================================================
  */
 
+#define _GNU_SOURCE
 #include <hev-lib.h>
 #include <stdio.h>
 #include <errno.h>
 #include <stdint.h>
 #include <string.h>
 #include <signal.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/epoll.h>
-#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
-static HevSList *client_list = NULL;
+/* freed clients kept for the next ones */
+#define CLIENT_POOL_SIZE	(1024)
 
 typedef struct _Client Client;
 
@@ -29,19 +31,32 @@ struct _Client
 	HevEventSourceFD *fd;
 	HevRingBuffer *buffer;
 	bool idle;
+
+	Client *prev;
+	Client *next;
 };
 
-static Client *
-client_new (void)
+static Client *client_list = NULL;
+
+static void
+client_list_add (Client *client)
 {
-	Client *client = HEV_MEMORY_ALLOCATOR_ALLOC (sizeof (Client));
-	if (client) {
-		client->fd = NULL;
-		client->buffer = NULL;
-		client->idle = false;
-	}
+	client->prev = NULL;
+	client->next = client_list;
+	if (client_list)
+	  client_list->prev = client;
+	client_list = client;
+}
 
-	return client;
+static void
+client_list_del (Client *client)
+{
+	if (client->prev)
+	  client->prev->next = client->next;
+	else
+	  client_list = client->next;
+	if (client->next)
+	  client->next->prev = client->prev;
 }
 
 static void
@@ -49,22 +64,12 @@ client_free (Client *client)
 {
 	if (client) {
 		close (client->fd->fd);
-		hev_event_source_del_fd (client->fd->source, client->fd->fd);
+		hev_event_source_remove_fd (client->fd->source, client->fd);
 		hev_ring_buffer_unref (client->buffer);
-		HEV_MEMORY_ALLOCATOR_FREE (client);
+		hev_event_source_listener_state_free (client);
 	}
 }
 
-static bool
-set_fd_nonblock (int fd, bool nonblock)
-{
-	int on = nonblock ? 1 : 0;
-	if (0 > ioctl (fd, FIONBIO, (char *) &on))
-	  return false;
-
-	return  true;
-}
-
 static ssize_t
 read_data (int fd, HevRingBuffer *buffer)
 {
@@ -156,38 +161,34 @@ client_source_handler (HevEventSourceFD *fd, void *data)
 
 remove_client:
 	printf ("Client %d leave\n", fd->fd);
+	client_list_del (client);
 	client_free (client);
-	client_list = hev_slist_remove (client_list, client);
 
 	return true;
 }
 
 static bool
-listener_source_handler (HevEventSourceFD *fd, void *data)
+listener_source_handler (HevEventSource *source, HevEventSourceListenerConn *conns,
+			unsigned int count, void *data)
 {
 	HevEventSource *client_source = data;
-	struct sockaddr_in addr;
-	socklen_t addr_len;
-	int client_fd = 0;
-
-	addr_len = sizeof (addr);
-	client_fd = accept (fd->fd, (struct sockaddr *) &addr,
-				(socklen_t *) &addr_len);
-	if (0 > client_fd) {
-		if (EAGAIN == errno)
-		  fd->revents &= ~EPOLLIN;
-		else
-		  printf ("Accept failed!\n");
-	} else {
-		Client *client = client_new ();
+	unsigned int i = 0;
+
+	for (i=0; i<count; i++) {
+		struct sockaddr_in *addr = (struct sockaddr_in *) &conns[i].addr;
+		/* zeroed, from the listener's pool */
+		Client *client = conns[i].state;
+
 		client->buffer = hev_ring_buffer_new (1024);
 		printf ("New client %d enter from %s:%u\n",
-			client_fd, inet_ntoa (addr.sin_addr), ntohs (addr.sin_port));
-		set_fd_nonblock (client_fd, true);
-		client->fd = hev_event_source_add_fd (client_source, client_fd, EPOLLIN | EPOLLOUT | EPOLLET);
+			conns[i].fd, inet_ntoa (addr->sin_addr), ntohs (addr->sin_port));
+		client->fd = hev_event_source_add_fd (client_source, conns[i].fd,
+					EPOLLIN | EPOLLOUT | EPOLLET);
 		hev_event_source_fd_set_data (client->fd, client);
-		client_list = hev_slist_append (client_list, client);
+		client_list_add (client);
 	}
+	if (hev_event_source_listener_get_error (source))
+	  printf ("Accept failed!\n");
 
 	return true;
 }
@@ -195,18 +196,17 @@ listener_source_handler (HevEventSourceFD *fd, void *data)
 static bool
 timeout_handler (void *data)
 {
-	HevSList *list = NULL;
-	for (list=client_list; list; list=hev_slist_next (list)) {
-		Client *client = hev_slist_data (list);
+	Client *client = NULL, *next = NULL;
+	for (client=client_list; client; client=next) {
+		next = client->next;
 		if (client->idle) {
 			printf ("Remove timeout client %d\n", client->fd->fd);
+			client_list_del (client);
 			client_free (client);
-			hev_slist_set_data (list, NULL);
 		} else {
 			client->idle = true;
 		}
 	}
-	client_list = hev_slist_remove_all (client_list, NULL);
 	return true;
 }
 
@@ -216,6 +216,27 @@ signal_pipe_handler (void *data)
 	return true;
 }
 
+static bool
+signal_usr1_handler (void *data)
+{
+	hev_event_loop_dump_stats (data, STDERR_FILENO);
+
+	return true;
+}
+
+static bool
+signal_usr2_handler (void *data)
+{
+	int fd = open ("echo-server-trace.json", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (0 <= fd) {
+		hev_event_loop_dump_trace (data, fd);
+		close (fd);
+	}
+
+	return true;
+}
+
 static bool
 signal_int_handler (void *data)
 {
@@ -232,17 +253,29 @@ main (int argc, char *argv[])
 {
 	HevEventLoop *loop = NULL;
 	HevEventSource *source = NULL, *listener_source = NULL, *client_source = NULL;
-	HevSList *list = NULL;
+	HevEventLoopBackend backend = HEV_EVENT_LOOP_BACKEND_EPOLL;
+	Client *client = NULL;
 	int fd = 0, reuseaddr = 1;
 	struct sockaddr_in addr;
 
-	loop = hev_event_loop_new ();
-
-	fd = socket (AF_INET, SOCK_STREAM, 0);
+	/* echo-server uring: waits on an io_uring, epoll if not supported */
+	if ((1 < argc) && (0 == strcmp (argv[1], "uring")))
+	  backend = HEV_EVENT_LOOP_BACKEND_URING;
+	loop = hev_event_loop_new_full (backend);
+	if (hev_event_loop_get_backend (loop) != backend)
+	  printf ("io_uring not supported, using epoll\n");
+	/* kill -USR1 dumps them, kill -USR2 writes the recent trace */
+	hev_event_loop_set_stats (loop, true);
+	hev_event_loop_set_trace (loop, 65536);
+	/* grows with the number of busy clients */
+	hev_event_loop_set_event_batch (loop, 64, 4096);
+	/* callbacks blocking the loop for 100 ms are reported to stderr */
+	hev_event_loop_set_watchdog (loop, 100, STDERR_FILENO);
+
+	fd = socket (AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 	if (0 > fd)
 	  exit (1);
 	setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &reuseaddr, sizeof (reuseaddr));
-	set_fd_nonblock (fd, true);
 	memset (&addr, 0, sizeof (addr));
 	addr.sin_family = AF_INET;
 	addr.sin_addr.s_addr = inet_addr ("0.0.0.0");
@@ -253,20 +286,27 @@ main (int argc, char *argv[])
 	  exit (3);
 
 	client_source = hev_event_source_fds_new ();
+	hev_event_source_set_name (client_source, "clients");
 	hev_event_source_set_callback (client_source,
 				(HevEventSourceFunc) client_source_handler, NULL, NULL);
 	hev_event_loop_add_source (loop, client_source);
 	hev_event_source_unref (client_source);
 
-	listener_source = hev_event_source_fds_new ();
+	/* accepts a batch a wakeup, clients come from its pool */
+	listener_source = hev_event_source_listener_new (fd, 0);
+	hev_event_source_listener_set_state (listener_source, sizeof (Client),
+				CLIENT_POOL_SIZE);
+	hev_event_source_set_name (listener_source, "listener");
 	hev_event_source_set_priority (listener_source, 2);
-	hev_event_source_add_fd (listener_source, fd, EPOLLIN | EPOLLET);
 	hev_event_source_set_callback (listener_source,
 				(HevEventSourceFunc) listener_source_handler, client_source, NULL);
 	hev_event_loop_add_source (loop, listener_source);
 	hev_event_source_unref (listener_source);
 
 	source = hev_event_source_timeout_new (30 * 1000);
+	hev_event_source_set_name (source, "idle-reaper");
+	/* no hurry, it may share a wakeup with other timers */
+	hev_event_source_timeout_set_slack (source, UINT64_C (1000) * 1000 * 1000);
 	hev_event_source_set_priority (source, 1);
 	hev_event_source_set_callback (source, timeout_handler, NULL, NULL);
 	hev_event_loop_add_source (loop, source);
@@ -283,11 +323,24 @@ main (int argc, char *argv[])
 	hev_event_loop_add_source (loop, source);
 	hev_event_source_unref (source);
 
+	source = hev_event_source_signal_new (SIGUSR1);
+	hev_event_source_set_callback (source, signal_usr1_handler, loop, NULL);
+	hev_event_loop_add_source (loop, source);
+	hev_event_source_unref (source);
+
+	source = hev_event_source_signal_new (SIGUSR2);
+	hev_event_source_set_name (source, "trace-dump");
+	hev_event_source_set_callback (source, signal_usr2_handler, loop, NULL);
+	hev_event_loop_add_source (loop, source);
+	hev_event_source_unref (source);
+
 	hev_event_loop_run (loop);
 
-	for (list=client_list; list; list=hev_slist_next (list))
-	  client_free (hev_slist_data (list));
-	hev_slist_free (client_list);
+	while (client_list) {
+		client = client_list;
+		client_list_del (client);
+		client_free (client);
+	}
 
 	close (fd);
 	hev_event_loop_unref (loop);
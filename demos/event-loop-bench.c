@@ -0,0 +1,128 @@
+/*
+ ============================================================================
+ Name        : event-loop-bench.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2013 everyone.
+ Description : Event loop dispatch benchmark
+ ============================================================================
+ */
+
+#include <hev-lib.h>
+#include <stdio.h>
+#include <time.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+#define MAX_READY_FDS	(16384)
+#define ROUNDS		(16)
+
+static HevEventLoop *loop = NULL;
+static unsigned int pending = 0;
+static HevEventLoopSchedPolicy policy = HEV_EVENT_LOOP_SCHED_PRIORITY;
+
+static bool
+ready_handler (HevEventSourceFD *fd, void *data)
+{
+	eventfd_t val = 0;
+
+	eventfd_read (fd->fd, &val);
+	fd->revents &= ~EPOLLIN;
+	pending --;
+	if (0 == pending)
+	  hev_event_loop_quit (loop);
+
+	return true;
+}
+
+static uint64_t
+now_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t
+bench (unsigned int count)
+{
+	HevSList *sources = NULL, *list = NULL;
+	uint64_t begin = 0, end = 0;
+	int *fds = NULL;
+	unsigned int i = 0;
+
+	loop = hev_event_loop_new ();
+	hev_event_loop_set_sched_policy (loop, policy);
+	fds = HEV_MEMORY_ALLOCATOR_ALLOC (sizeof (int) * count);
+
+	for (i=0; i<count; i++) {
+		HevEventSource *source = hev_event_source_fds_new ();
+		fds[i] = eventfd (0, EFD_NONBLOCK);
+		/* spread over a few priorities, the usual proxy layout */
+		hev_event_source_set_priority (source, i % 4);
+		hev_event_source_add_fd (source, fds[i], EPOLLIN | EPOLLET);
+		hev_event_source_set_callback (source,
+					(HevEventSourceFunc) ready_handler, NULL, NULL);
+		hev_event_loop_add_source (loop, source);
+		sources = hev_slist_prepend (sources, source);
+	}
+
+	/* make all fds ready at once, then drain them */
+	for (i=0; i<count; i++)
+	  eventfd_write (fds[i], 1);
+	pending = count;
+	begin = now_ns ();
+	hev_event_loop_run (loop);
+	end = now_ns ();
+
+	for (list=sources; list; list=hev_slist_next (list))
+	  hev_event_source_unref (hev_slist_data (list));
+	hev_slist_free (sources);
+	hev_event_loop_unref (loop);
+	for (i=0; i<count; i++)
+	  close (fds[i]);
+	HEV_MEMORY_ALLOCATOR_FREE (fds);
+
+	return end - begin;
+}
+
+int
+main (int argc, char *argv[])
+{
+	struct rlimit limit;
+	unsigned int count = 0, max = MAX_READY_FDS;
+
+	if (1 < argc) {
+		if (0 == strcmp (argv[1], "weighted"))
+		  policy = HEV_EVENT_LOOP_SCHED_WEIGHTED;
+		else if (0 == strcmp (argv[1], "aging"))
+		  policy = HEV_EVENT_LOOP_SCHED_AGING;
+	}
+
+	/* each ready fd is an eventfd, raise the fd limit if we can */
+	if (0 == getrlimit (RLIMIT_NOFILE, &limit)) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit (RLIMIT_NOFILE, &limit);
+		getrlimit (RLIMIT_NOFILE, &limit);
+		if (limit.rlim_cur < (max + 64))
+		  max = limit.rlim_cur - 64;
+	}
+
+	printf ("%10s %14s %14s\n", "ready fds", "ns/iteration", "ns/dispatch");
+	for (count=1; count<=max; count*=4) {
+		uint64_t total = 0;
+		unsigned int i = 0;
+
+		for (i=0; i<ROUNDS; i++)
+		  total += bench (count);
+		total /= ROUNDS;
+		printf ("%10u %14llu %14llu\n", count, (unsigned long long) total,
+					(unsigned long long) (total / count));
+	}
+
+	return 0;
+}
+
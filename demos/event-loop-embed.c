@@ -0,0 +1,69 @@
+/*
+ ============================================================================
+ Name        : event-loop-embed.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2013 everyone.
+ Description : An event loop driven by an outer poll loop example
+ ============================================================================
+ */
+
+#include <poll.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <hev-lib.h>
+
+static bool
+timeout_handler (void *data)
+{
+	unsigned int *ticks = data;
+
+	printf ("inner loop: tick %u\n", ++ *ticks);
+	return true;
+}
+
+int
+main (int argc, char *argv[])
+{
+	HevEventLoop *loop = NULL;
+	HevEventSource *timeout = NULL;
+	unsigned int ticks = 0;
+	bool pending = false;
+	bool run = true;
+
+	loop = hev_event_loop_new ();
+
+	timeout = hev_event_source_timeout_new (500);
+	hev_event_source_set_callback (timeout, timeout_handler, &ticks, NULL);
+	hev_event_loop_add_source (loop, timeout);
+	hev_event_source_unref (timeout);
+
+	/* the outer loop owns stdin, the inner one its timer */
+	while (run) {
+		struct pollfd fds[2] = {
+			{ .fd = STDIN_FILENO, .events = POLLIN },
+			{ .fd = hev_event_loop_get_fd (loop), .events = POLLIN },
+		};
+		int timeout_ms = pending ? 0 : hev_event_loop_get_timeout (loop);
+
+		if (0 > poll (fds, 2, timeout_ms))
+		  break;
+
+		if (fds[0].revents) {
+			char buf[256];
+			ssize_t size = read (STDIN_FILENO, buf, sizeof (buf));
+
+			if (0 < size)
+			  printf ("outer loop: %zd bytes from stdin\n", size);
+			else
+			  run = false;
+		}
+
+		pending = hev_event_loop_iterate (loop, false);
+		fflush (stdout);
+	}
+
+	hev_event_loop_unref (loop);
+
+	return 0;
+}
+
@@ -0,0 +1,131 @@
+/*
+ ============================================================================
+ Name        : event-source-del.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2013 everyone.
+ Description : Idle and deleted held sources test
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <hev-lib.h>
+
+static unsigned int dispatches = 0;
+
+static uint64_t
+now_ms (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool
+deleted_handler (void *data)
+{
+	dispatches ++;
+	return true;
+}
+
+static bool
+timeout_handler (void *data)
+{
+	hev_event_loop_quit (data);
+	return true;
+}
+
+static bool
+idle_handler (void *data)
+{
+	dispatches ++;
+	hev_event_loop_quit (data);
+	return true;
+}
+
+/* An idle source alone must be dispatched by run, not wait for events. */
+static bool
+test_idle_only (void)
+{
+	HevEventLoop *loop = NULL;
+	HevEventSource *idle = NULL, *timeout = NULL;
+	uint64_t begin = 0, elapsed = 0;
+	bool res = false;
+
+	loop = hev_event_loop_new ();
+	idle = hev_event_source_idle_new ();
+	hev_event_source_set_callback (idle, idle_handler, loop, NULL);
+	hev_event_loop_add_source (loop, idle);
+	hev_event_source_unref (idle);
+	/* the way out if the idle source is not dispatched */
+	timeout = hev_event_source_timeout_new (1000);
+	hev_event_source_set_callback (timeout, timeout_handler, loop, NULL);
+	hev_event_loop_add_source (loop, timeout);
+	hev_event_source_unref (timeout);
+
+	dispatches = 0;
+	begin = now_ms ();
+	hev_event_loop_run (loop);
+	elapsed = now_ms () - begin;
+	hev_event_loop_unref (loop);
+
+	/* at once, not after waiting for the timer */
+	res = (1 == dispatches) && (100 > elapsed);
+	printf ("idle only: %u dispatches in %u ms: %s\n", dispatches,
+				(unsigned int) elapsed, res ? "ok" : "FAILED");
+
+	return res;
+}
+
+/* A source deleted from the loop, but still referenced, must neither be
+ * dispatched nor keep the loop from blocking until the next timer. */
+static bool
+test (const char *name, HevEventSource *source)
+{
+	HevEventLoop *loop = NULL;
+	HevEventSource *timeout = NULL;
+	uint64_t begin = 0;
+	unsigned int iterations = 0;
+	bool res = false;
+
+	loop = hev_event_loop_new ();
+	hev_event_source_set_callback (source, deleted_handler, NULL, NULL);
+	hev_event_loop_add_source (loop, source);
+	/* the idle source is queued by now, the timer armed */
+	hev_event_loop_iterate (loop, false);
+	hev_event_loop_del_source (loop, source);
+	dispatches = 0;
+
+	timeout = hev_event_source_timeout_new (100);
+	hev_event_source_set_callback (timeout, timeout_handler, loop, NULL);
+	hev_event_loop_add_source (loop, timeout);
+	hev_event_source_unref (timeout);
+
+	begin = now_ms ();
+	while ((now_ms () - begin) < 100) {
+		hev_event_loop_iterate (loop, true);
+		iterations ++;
+	}
+	hev_event_loop_unref (loop);
+
+	/* a blocking wait or two until the timer, not a spin */
+	res = (iterations <= 4) && !dispatches;
+	printf ("%s: %u iterations, %u dispatches after delete: %s\n", name,
+				iterations, dispatches, res ? "ok" : "FAILED");
+	hev_event_source_unref (source);
+
+	return res;
+}
+
+int
+main (int argc, char *argv[])
+{
+	bool res = true;
+
+	res &= test_idle_only ();
+	res &= test ("idle", hev_event_source_idle_new ());
+	res &= test ("timeout", hev_event_source_timeout_new (10));
+
+	return res ? 0 : 1;
+}
@@ -0,0 +1,182 @@
+/*
+ ============================================================================
+ Name        : event-source-listener-bench.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2013 everyone.
+ Description : Connection accept rate benchmark
+ ============================================================================
+ */
+
+#include <hev-lib.h>
+#include <stdio.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define CLIENT_THREADS	(4)
+#define CONNECTIONS	(40000)
+/* what a server would keep per connection */
+#define STATE_SIZE	(256)
+
+static HevEventLoop *loop = NULL;
+static struct sockaddr_in server_addr;
+static unsigned int total = 0;
+static unsigned int accepted = 0;
+static unsigned int dispatches = 0;
+
+static uint64_t
+now_ns (clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime (clock, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+conn_done (int fd)
+{
+	struct linger linger = { .l_onoff = 1, .l_linger = 0 };
+
+	/* reset, no TIME_WAIT to run out of ports with */
+	setsockopt (fd, SOL_SOCKET, SO_LINGER, &linger, sizeof (linger));
+	close (fd);
+	accepted ++;
+	if (accepted == total)
+	  hev_event_loop_quit (loop);
+}
+
+/* One connection a dispatch, as the demos used to. */
+static bool
+fds_handler (HevEventSourceFD *fd, void *data)
+{
+	void *state = NULL;
+	int client_fd = -1, on = 1;
+
+	client_fd = accept (fd->fd, NULL, NULL);
+	if (0 > client_fd) {
+		if (EAGAIN == errno)
+		  fd->revents &= ~EPOLLIN;
+		return true;
+	}
+
+	ioctl (client_fd, FIONBIO, (char *) &on);
+	state = HEV_MEMORY_ALLOCATOR_ALLOC (STATE_SIZE);
+	memset (state, 0, STATE_SIZE);
+	HEV_MEMORY_ALLOCATOR_FREE (state);
+	dispatches ++;
+	conn_done (client_fd);
+
+	return true;
+}
+
+static bool
+listener_handler (HevEventSource *source, HevEventSourceListenerConn *conns,
+			unsigned int count, void *data)
+{
+	unsigned int i = 0;
+
+	for (i=0; i<count; i++) {
+		hev_event_source_listener_state_free (conns[i].state);
+		conn_done (conns[i].fd);
+	}
+	dispatches ++;
+
+	return true;
+}
+
+static void *
+client_thread_handler (void *data)
+{
+	unsigned int i = 0, count = total / CLIENT_THREADS;
+
+	for (i=0; i<count; ) {
+		int fd = socket (AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+		if (0 > fd)
+		  continue;
+		/* refused when the accept queue overflows, again */
+		if (0 == connect (fd, (struct sockaddr *) &server_addr, sizeof (server_addr)))
+		  i ++;
+		close (fd);
+	}
+
+	return NULL;
+}
+
+static void
+bench (const char *name, bool batched)
+{
+	pthread_t threads[CLIENT_THREADS];
+	HevEventSource *source = NULL;
+	socklen_t addr_len = sizeof (server_addr);
+	uint64_t begin = 0, end = 0, cpu_begin = 0, cpu_end = 0;
+	unsigned int i = 0;
+	int fd = -1;
+
+	fd = socket (AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	memset (&server_addr, 0, sizeof (server_addr));
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_addr.s_addr = inet_addr ("127.0.0.1");
+	if ((0 > bind (fd, (struct sockaddr *) &server_addr, sizeof (server_addr))) ||
+		(0 > listen (fd, 4096)) ||
+		(0 > getsockname (fd, (struct sockaddr *) &server_addr, &addr_len))) {
+		printf ("Listen failed!\n");
+		exit (1);
+	}
+
+	loop = hev_event_loop_new ();
+	if (batched) {
+		source = hev_event_source_listener_new (fd, 0);
+		hev_event_source_listener_set_state (source, STATE_SIZE, 1024);
+	} else {
+		source = hev_event_source_fds_new ();
+		hev_event_source_add_fd (source, fd, EPOLLIN | EPOLLET);
+	}
+	hev_event_source_set_callback (source, batched ?
+				(HevEventSourceFunc) listener_handler :
+				(HevEventSourceFunc) fds_handler, NULL, NULL);
+	hev_event_loop_add_source (loop, source);
+	hev_event_source_unref (source);
+
+	total = (CONNECTIONS / CLIENT_THREADS) * CLIENT_THREADS;
+	accepted = 0;
+	dispatches = 0;
+	begin = now_ns (CLOCK_MONOTONIC);
+	cpu_begin = now_ns (CLOCK_THREAD_CPUTIME_ID);
+	for (i=0; i<CLIENT_THREADS; i++)
+	  pthread_create (&threads[i], NULL, client_thread_handler, NULL);
+	hev_event_loop_run (loop);
+	cpu_end = now_ns (CLOCK_THREAD_CPUTIME_ID);
+	end = now_ns (CLOCK_MONOTONIC);
+	for (i=0; i<CLIENT_THREADS; i++)
+	  pthread_join (threads[i], NULL);
+
+	hev_event_loop_unref (loop);
+	close (fd);
+
+	/* the clients' connects take most of the time, the loop's cpu time
+	 * per connection is what the source changes */
+	printf ("%10s %10u %14.0f %14.1f %14.0f\n", name, accepted,
+				accepted * 1e9 / (end - begin), (double) accepted / dispatches,
+				(double) (cpu_end - cpu_begin) / accepted);
+}
+
+int
+main (int argc, char *argv[])
+{
+	printf ("%10s %10s %14s %14s %14s\n", "source", "conns", "conns/s",
+				"conns/dispatch", "loop ns/conn");
+	bench ("fds", false);
+	bench ("listener", true);
+
+	return 0;
+}
+
@@ -0,0 +1,154 @@
+/*
+ ============================================================================
+ Name        : event-source-relay-bench.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2013 everyone.
+ Description : TCP relay throughput benchmark
+ ============================================================================
+ */
+
+#define _GNU_SOURCE
+#include <hev-lib.h>
+#include <stdio.h>
+#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define BENCH_BYTES	(4ULL * 1024 * 1024 * 1024)
+#define BENCH_CHUNK	(256 * 1024)
+
+static int listen_fd = -1;
+static struct sockaddr_in server_addr;
+
+static uint64_t
+now_ns (clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime (clock, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* A loopback connection, the accepted end nonblocking for the relay. */
+static void
+pair_new (int fds[2])
+{
+	fds[0] = socket (AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	connect (fds[0], (struct sockaddr *) &server_addr, sizeof (server_addr));
+	fds[1] = accept4 (listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+}
+
+static void *
+source_thread_handler (void *data)
+{
+	static char buffer[BENCH_CHUNK];
+	int fd = *(int *) data;
+	uint64_t sent = 0;
+
+	while (sent < BENCH_BYTES) {
+		ssize_t size = write (fd, buffer, sizeof (buffer));
+		if (0 >= size)
+		  break;
+		sent += size;
+	}
+	shutdown (fd, SHUT_WR);
+
+	return NULL;
+}
+
+static void *
+sink_thread_handler (void *data)
+{
+	static char buffer[BENCH_CHUNK];
+	int fd = *(int *) data;
+
+	while (0 < read (fd, buffer, sizeof (buffer)))
+	  ;
+	shutdown (fd, SHUT_WR);
+
+	return NULL;
+}
+
+static bool
+relay_handler (HevEventSource *source, int error, void *data)
+{
+	HevEventLoop *loop = data;
+
+	if (error)
+	  printf ("Relay failed: %s\n", strerror (error));
+	hev_event_loop_quit (loop);
+
+	return false;
+}
+
+static void
+bench (const char *name, bool splice)
+{
+	pthread_t source_thread, sink_thread;
+	HevEventLoop *loop = NULL;
+	HevEventSource *source = NULL;
+	uint64_t begin = 0, end = 0, cpu_begin = 0, cpu_end = 0, bytes = 0;
+	int client[2], remote[2];
+
+	pair_new (client);
+	pair_new (remote);
+
+	loop = hev_event_loop_new ();
+	source = hev_event_source_relay_new (client[1], remote[1], splice);
+	hev_event_source_set_callback (source, (HevEventSourceFunc) relay_handler, loop, NULL);
+	hev_event_loop_add_source (loop, source);
+
+	begin = now_ns (CLOCK_MONOTONIC);
+	cpu_begin = now_ns (CLOCK_THREAD_CPUTIME_ID);
+	pthread_create (&source_thread, NULL, source_thread_handler, &client[0]);
+	pthread_create (&sink_thread, NULL, sink_thread_handler, &remote[0]);
+	hev_event_loop_run (loop);
+	cpu_end = now_ns (CLOCK_THREAD_CPUTIME_ID);
+	end = now_ns (CLOCK_MONOTONIC);
+	pthread_join (source_thread, NULL);
+	pthread_join (sink_thread, NULL);
+
+	bytes = hev_event_source_relay_get_bytes (source, HEV_EVENT_SOURCE_RELAY_FORWARD);
+	printf ("%10s %10s %14.0f %14.0f\n", name,
+				hev_event_source_relay_get_splice (source) ? "yes" : "no",
+				bytes * 1e3 / (end - begin),
+				(double) (cpu_end - cpu_begin) * (1ULL << 30) / bytes / 1e6);
+
+	hev_event_source_unref (source);
+	hev_event_loop_unref (loop);
+	close (client[0]);
+	close (client[1]);
+	close (remote[0]);
+	close (remote[1]);
+}
+
+int
+main (int argc, char *argv[])
+{
+	socklen_t addr_len = sizeof (server_addr);
+
+	listen_fd = socket (AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	memset (&server_addr, 0, sizeof (server_addr));
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_addr.s_addr = inet_addr ("127.0.0.1");
+	if ((0 > bind (listen_fd, (struct sockaddr *) &server_addr, sizeof (server_addr))) ||
+		(0 > listen (listen_fd, 16)) ||
+		(0 > getsockname (listen_fd, (struct sockaddr *) &server_addr, &addr_len))) {
+		printf ("Listen failed!\n");
+		exit (1);
+	}
+
+	/* the loop thread's cpu time is what the relay spends, the peers
+	 * run in their own threads */
+	printf ("%10s %10s %14s %14s\n", "mode", "splice", "MB/s", "loop ms/GB");
+	bench ("copy", false);
+	bench ("splice", true);
+	close (listen_fd);
+
+	return 0;
+}
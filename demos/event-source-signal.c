@@ -14,7 +14,9 @@
 static bool
 signal_handler (void *data)
 {
-	printf ("signal\n");
+	const struct signalfd_siginfo *info = hev_event_source_signal_get_info (data);
+
+	printf ("signal %u from pid %u\n", info->ssi_signo, info->ssi_pid);
 
 	return true;
 }
@@ -28,7 +30,7 @@ main (int argc, char *argv[])
 	loop = hev_event_loop_new ();
 
 	signal = hev_event_source_signal_new (SIGQUIT);
-	hev_event_source_set_callback (signal, signal_handler, NULL, NULL);
+	hev_event_source_set_callback (signal, signal_handler, signal, NULL);
 	hev_event_loop_add_source (loop, signal);
 	hev_event_source_unref (signal);
 
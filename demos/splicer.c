@@ -3,10 +3,11 @@
  Name        : splicer.c
  Author      : Heiher <r@hev.cc>
  Copyright   : Copyright (c) 2013 everyone.
- Description : Echo server example
+ Description : TCP relay example
  ============================================================================
  */
 
+#define _GNU_SOURCE
 #include <hev-lib.h>
 #include <stdio.h>
 #include <errno.h>
@@ -15,271 +16,147 @@
 #include <signal.h>
 #include <unistd.h>
 #include <sys/epoll.h>
-#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
-enum
-{
-	CLIENT_IN = (1 << 3),
-	CLIENT_OUT = (1 << 2),
-	REMOTE_IN = (1 << 1),
-	REMOTE_OUT = (1 << 0),
-};
-
-static HevSList *session_list = NULL;
+/* freed sessions kept for the next ones */
+#define SESSION_POOL_SIZE	(1024)
 
 typedef struct _Session Session;
 
 struct _Session
 {
 	HevEventSource *source;
-	HevEventSourceFD *client_fd;
-	HevEventSourceFD *remote_fd;
-	HevRingBuffer *forward_buffer;
-	HevRingBuffer *backward_buffer;
-	uint8_t revents;
+	int client_fd;
+	int remote_fd;
+	uint64_t bytes;
 	bool idle;
+
+	Session *prev;
+	Session *next;
 };
 
-static bool session_source_handler (HevEventSourceFD *fd, void *data);
+static Session *session_list = NULL;
+static bool session_splice = true;
 
+static bool session_relay_handler (HevEventSource *source, int error, void *data);
+
+/* session is a state of the listener's pool, the fds are its own */
 static Session *
-session_new (void)
+session_new (Session *session, int client_fd, int remote_fd)
 {
-	Session *session = HEV_MEMORY_ALLOCATOR_ALLOC (sizeof (Session));
 	if (session) {
-		session->source = hev_event_source_fds_new ();
+		session->source = hev_event_source_relay_new (client_fd, remote_fd,
+					session_splice);
+		if (!session->source)
+		  return NULL;
 		hev_event_source_set_callback (session->source,
-					(HevEventSourceFunc) session_source_handler, session, NULL);
-		session->client_fd = NULL;
-		session->remote_fd = NULL;
-		session->forward_buffer = NULL;
-		session->backward_buffer = NULL;
-		session->revents = 0;
+					(HevEventSourceFunc) session_relay_handler, session, NULL);
+		session->client_fd = client_fd;
+		session->remote_fd = remote_fd;
+		session->bytes = 0;
 		session->idle = false;
+		session->prev = NULL;
+		session->next = NULL;
 	}
 
 	return session;
 }
 
 static void
-session_free (Session *session)
+session_list_add (Session *session)
 {
-	if (session) {
-		if (session->remote_fd) {
-			close (session->remote_fd->fd);
-			hev_event_source_del_fd (session->source, session->remote_fd->fd);
-		}
-		if (session->client_fd) {
-			close (session->client_fd->fd);
-			hev_event_source_del_fd (session->source, session->client_fd->fd);
-		}
-		hev_ring_buffer_unref (session->forward_buffer);
-		hev_ring_buffer_unref (session->backward_buffer);
-		hev_event_source_unref (session->source);
-		HEV_MEMORY_ALLOCATOR_FREE (session);
-	}
+	session->prev = NULL;
+	session->next = session_list;
+	if (session_list)
+	  session_list->prev = session;
+	session_list = session;
 }
 
-static bool
-set_fd_nonblock (int fd, bool nonblock)
+static void
+session_list_del (Session *session)
 {
-	int on = nonblock ? 1 : 0;
-	if (0 > ioctl (fd, FIONBIO, (char *) &on))
-	  return false;
-
-	return  true;
+	if (session->prev)
+	  session->prev->next = session->next;
+	else
+	  session_list = session->next;
+	if (session->next)
+	  session->next->prev = session->prev;
 }
 
-static ssize_t
-read_data (int fd, HevRingBuffer *buffer)
+static void
+session_free (Session *session)
 {
-	struct msghdr mh;
-	struct iovec iovec[2];
-	size_t iovec_len = 0, inc_len = 0;
-	ssize_t size = -2;
-
-	iovec_len = hev_ring_buffer_writing (buffer, iovec);
-	if (0 < iovec_len) {
-		/* recv data */
-		memset (&mh, 0, sizeof (mh));
-		mh.msg_iov = iovec;
-		mh.msg_iovlen = iovec_len;
-		size = recvmsg (fd, &mh, 0);
-		inc_len = (0 > size) ? 0 : size;
-		hev_ring_buffer_write_finish (buffer, inc_len);
-	}
-
-	return size;
-}
+	if (session) {
+		HevEventLoop *loop = hev_event_source_get_loop (session->source);
 
-static ssize_t
-write_data (int fd, HevRingBuffer *buffer)
-{
-	struct msghdr mh;
-	struct iovec iovec[2];
-	size_t iovec_len = 0, inc_len = 0;
-	ssize_t size = -2;
-
-	iovec_len = hev_ring_buffer_reading (buffer, iovec);
-	if (0 < iovec_len) {
-		/* send data */
-		memset (&mh, 0, sizeof (mh));
-		mh.msg_iov = iovec;
-		mh.msg_iovlen = iovec_len;
-		size = sendmsg (fd, &mh, 0);
-		inc_len = (0 > size) ? 0 : size;
-		hev_ring_buffer_read_finish (buffer, inc_len);
+		if (loop)
+		  hev_event_loop_del_source (loop, session->source);
+		hev_event_source_unref (session->source);
+		close (session->remote_fd);
+		close (session->client_fd);
+		hev_event_source_listener_state_free (session);
 	}
-
-	return size;
 }
 
+/* Both ways done, or failed. */
 static bool
-session_source_handler (HevEventSourceFD *fd, void *data)
+session_relay_handler (HevEventSource *source, int error, void *data)
 {
 	Session *session = data;
-	ssize_t size = 0;
-
-	if ((EPOLLERR | EPOLLHUP) & fd->revents)
-	  goto remove_session;
-
-	if (fd == session->client_fd) {
-		if (EPOLLIN & fd->revents)
-		  session->revents |= CLIENT_IN;
-		if (EPOLLOUT & fd->revents)
-		  session->revents |= CLIENT_OUT;
-	} else {
-		if (EPOLLIN & fd->revents)
-		  session->revents |= REMOTE_IN;
-		if (EPOLLOUT & fd->revents)
-		  session->revents |= REMOTE_OUT;
-	}
-
-	if (CLIENT_OUT & session->revents) {
-		size = write_data (session->client_fd->fd, session->backward_buffer);
-		if (-2 < size) {
-			if (-1 == size) {
-				if (EAGAIN == errno) {
-					session->revents &= ~CLIENT_OUT;
-					session->client_fd->revents &= ~EPOLLOUT;
-				} else {
-					goto remove_session;
-				}
-			}
-		} else {
-			session->client_fd->revents &= ~EPOLLOUT;
-		}
-	}
-
-	if (REMOTE_OUT & session->revents) {
-		size = write_data (session->remote_fd->fd, session->forward_buffer);
-		if (-2 < size) {
-			if (-1 == size) {
-				if (EAGAIN == errno) {
-					session->revents &= ~REMOTE_OUT;
-					session->remote_fd->revents &= ~EPOLLOUT;
-				} else {
-					goto remove_session;
-				}
-			}
-		} else {
-			session->remote_fd->revents &= ~EPOLLOUT;
-		}
-	}
-
-	if (CLIENT_IN & session->revents) {
-		size = read_data (session->client_fd->fd, session->forward_buffer);
-		if (-2 < size) {
-			if (-1 == size) {
-				if (EAGAIN == errno) {
-					session->revents &= ~CLIENT_IN;
-					session->client_fd->revents &= ~EPOLLIN;
-				} else {
-					goto remove_session;
-				}
-			} else if (0 == size) {
-				goto remove_session;
-			}
-		} else {
-			session->client_fd->revents &= ~EPOLLIN;
-		}
-	}
-
-	if (REMOTE_IN & session->revents) {
-		size = read_data (session->remote_fd->fd, session->backward_buffer);
-		if (-2 < size) {
-			if (-1 == size) {
-				if (EAGAIN == errno) {
-					session->revents &= ~REMOTE_IN;
-					session->remote_fd->revents &= ~EPOLLIN;
-				} else {
-					goto remove_session;
-				}
-			} else if (0 == size) {
-				goto remove_session;
-			}
-		} else {
-			session->remote_fd->revents &= ~EPOLLIN;
-		}
-	}
-
-	session->idle = false;
 
-	return true;
-
-remove_session:
-	/* printf ("Remove session %p\n", session); */
+	/* printf ("Remove session %p (%s)\n", session, strerror (error)); */
+	session_list_del (session);
 	session_free (session);
-	session_list = hev_slist_remove (session_list, session);
 
-	return false;
+	return true;
 }
 
 static bool
-listener_source_handler (HevEventSourceFD *fd, void *data)
+listener_source_handler (HevEventSource *source, HevEventSourceListenerConn *conns,
+			unsigned int count, void *data)
 {
 	HevEventLoop *loop = data;
-	struct sockaddr_in addr, raddr;
-	socklen_t addr_len;
-	int client_fd = -1, remote_fd = -1;
-
-	addr_len = sizeof (addr);
-	client_fd = accept (fd->fd, (struct sockaddr *) &addr,
-				(socklen_t *) &addr_len);
-	if (0 > client_fd) {
-		if (EAGAIN == errno)
-		  fd->revents &= ~EPOLLIN;
-		else
-		  printf ("Accept failed!\n");
-	} else {
-		Session *session = session_new ();
-		hev_event_loop_add_source (loop, session->source);
-		set_fd_nonblock (client_fd, true);
-		session->client_fd = hev_event_source_add_fd (session->source, client_fd,
-					EPOLLIN | EPOLLOUT | EPOLLET);
-		remote_fd = socket (AF_INET, SOCK_STREAM, 0);
-		set_fd_nonblock (remote_fd, true);
-		session->remote_fd = hev_event_source_add_fd (session->source, remote_fd,
-					EPOLLIN | EPOLLOUT | EPOLLET);
+	unsigned int i = 0;
+
+	for (i=0; i<count; i++) {
+		struct sockaddr_in raddr;
+		Session *session = NULL;
+		int remote_fd = -1;
+
+		remote_fd = socket (AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 		memset (&raddr, 0, sizeof (raddr));
 		raddr.sin_family = AF_INET;
 		raddr.sin_addr.s_addr = inet_addr ("127.0.0.1");
 		raddr.sin_port = htons (22);
-		if ((0 > connect (remote_fd, (struct sockaddr *) &raddr,
-						sizeof (raddr))) && (EINPROGRESS != errno)) {
-			printf ("Connect to remote host failed, remove session %p\n", session);
-			session_free (session);
-			return true;
+		if ((0 > remote_fd) || ((0 > connect (remote_fd, (struct sockaddr *) &raddr,
+							sizeof (raddr))) && (EINPROGRESS != errno))) {
+			printf ("Connect to remote host failed!\n");
+			if (0 <= remote_fd)
+			  close (remote_fd);
+			close (conns[i].fd);
+			hev_event_source_listener_state_free (conns[i].state);
+			continue;
 		}
-		session->forward_buffer = hev_ring_buffer_new (2000);
-		session->backward_buffer = hev_ring_buffer_new (2000);
+
+		/* relayed once the remote connects */
+		session = session_new (conns[i].state, conns[i].fd, remote_fd);
+		if (!session) {
+			close (remote_fd);
+			close (conns[i].fd);
+			hev_event_source_listener_state_free (conns[i].state);
+			continue;
+		}
+		hev_event_loop_add_source (loop, session->source);
 		/* printf ("New session %p (%d, %d) enter from %s:%u\n", session,
-			client_fd, remote_fd, inet_ntoa (addr.sin_addr), ntohs (addr.sin_port)); */
-		session_list = hev_slist_append (session_list, session);
+			conns[i].fd, remote_fd,
+			inet_ntoa (((struct sockaddr_in *) &conns[i].addr)->sin_addr),
+			ntohs (((struct sockaddr_in *) &conns[i].addr)->sin_port)); */
+		session_list_add (session);
 	}
+	if (hev_event_source_listener_get_error (source))
+	  printf ("Accept failed!\n");
 
 	return true;
 }
@@ -287,20 +164,27 @@ listener_source_handler (HevEventSourceFD *fd, void *data)
 static bool
 timeout_handler (void *data)
 {
-	HevEventLoop *loop = data;
-	HevSList *list = NULL;
-	for (list=session_list; list; list=hev_slist_next (list)) {
-		Session *session = hev_slist_data (list);
-		if (session->idle) {
+	Session *session = NULL, *next = NULL;
+
+	for (session=session_list; session; session=next) {
+		uint64_t bytes;
+
+		next = session->next;
+		bytes = hev_event_source_relay_get_bytes (session->source,
+					HEV_EVENT_SOURCE_RELAY_FORWARD) +
+			hev_event_source_relay_get_bytes (session->source,
+					HEV_EVENT_SOURCE_RELAY_BACKWARD);
+		if (bytes != session->bytes) {
+			session->bytes = bytes;
+			session->idle = false;
+		} else if (session->idle) {
 			/* printf ("Remove timeout session %p\n", session); */
-			hev_event_loop_del_source (loop, session->source);
+			session_list_del (session);
 			session_free (session);
-			hev_slist_set_data (list, NULL);
 		} else {
 			session->idle = true;
 		}
 	}
-	session_list = hev_slist_remove_all (session_list, NULL);
 	return true;
 }
 
@@ -326,17 +210,24 @@ main (int argc, char *argv[])
 {
 	HevEventLoop *loop = NULL;
 	HevEventSource *source = NULL, *listener_source = NULL;
-	HevSList *list = NULL;
+	Session *session = NULL;
 	int fd = -1, reuseaddr = 1;
 	struct sockaddr_in addr;
 
+	/* splicer [copy]: relay through buffers, to compare */
+	if ((1 < argc) && (0 == strcmp (argv[1], "copy")))
+	  session_splice = false;
+
 	loop = hev_event_loop_new ();
+	/* every accept adds two fds, register them with one wait */
+	hev_event_loop_set_defer_changes (loop, true);
+	/* busy sessions must not starve the idle session reaper */
+	hev_event_loop_set_sched_policy (loop, HEV_EVENT_LOOP_SCHED_AGING);
 
-	fd = socket (AF_INET, SOCK_STREAM, 0);
+	fd = socket (AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 	if (0 > fd)
 	  exit (1);
 	setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &reuseaddr, sizeof (reuseaddr));
-	set_fd_nonblock (fd, true);
 	memset (&addr, 0, sizeof (addr));
 	addr.sin_family = AF_INET;
 	addr.sin_addr.s_addr = inet_addr ("0.0.0.0");
@@ -346,9 +237,11 @@ main (int argc, char *argv[])
 	if (0 > listen (fd, 100))
 	  exit (3);
 
-	listener_source = hev_event_source_fds_new ();
+	/* accepts a batch a wakeup, sessions come from its pool */
+	listener_source = hev_event_source_listener_new (fd, 0);
+	hev_event_source_listener_set_state (listener_source, sizeof (Session),
+				SESSION_POOL_SIZE);
 	hev_event_source_set_priority (listener_source, 2);
-	hev_event_source_add_fd (listener_source, fd, EPOLLIN | EPOLLET);
 	hev_event_source_set_callback (listener_source,
 				(HevEventSourceFunc) listener_source_handler, loop, NULL);
 	hev_event_loop_add_source (loop, listener_source);
@@ -373,9 +266,11 @@ main (int argc, char *argv[])
 
 	hev_event_loop_run (loop);
 
-	for (list=session_list; list; list=hev_slist_next (list))
-	  session_free (hev_slist_data (list));
-	hev_slist_free (session_list);
+	while (session_list) {
+		session = session_list;
+		session_list_del (session);
+		session_free (session);
+	}
 
 	close (fd);
 	hev_event_loop_unref (loop);
@@ -0,0 +1 @@
+../src/hev-event-loop-runtime.h
\ No newline at end of file
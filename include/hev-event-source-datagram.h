@@ -0,0 +1 @@
+../src/hev-event-source-datagram.h
\ No newline at end of file
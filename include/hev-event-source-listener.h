@@ -0,0 +1 @@
+../src/hev-event-source-listener.h
\ No newline at end of file
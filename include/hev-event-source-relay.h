@@ -0,0 +1 @@
+../src/hev-event-source-relay.h
\ No newline at end of file
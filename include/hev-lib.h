@@ -22,12 +22,17 @@ extern "C" {
 #include <hev-hash-table.h>
 #include <hev-async-queue.h>
 #include <hev-ring-buffer.h>
+#include <hev-timer-wheel.h>
 #include <hev-event-loop.h>
+#include <hev-event-loop-runtime.h>
 #include <hev-event-source.h>
 #include <hev-event-source-idle.h>
 #include <hev-event-source-timeout.h>
 #include <hev-event-source-signal.h>
 #include <hev-event-source-fds.h>
+#include <hev-event-source-listener.h>
+#include <hev-event-source-datagram.h>
+#include <hev-event-source-relay.h>
 
 #ifdef __cplusplus
 }
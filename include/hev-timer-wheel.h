@@ -0,0 +1 @@
+../src/hev-timer-wheel.h
\ No newline at end of file
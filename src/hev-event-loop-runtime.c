@@ -0,0 +1,394 @@
+/*
+ ============================================================================
+ Name        : hev-event-loop-runtime.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2013 everyone.
+ Description : Event loops on multiple cores
+ ============================================================================
+ */
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+
+#include "hev-event-loop-runtime.h"
+#include "hev-memory-allocator-slice.h"
+
+typedef struct _HevEventLoopRuntimeListener HevEventLoopRuntimeListener;
+typedef struct _HevEventLoopRuntimeWorker HevEventLoopRuntimeWorker;
+
+struct _HevEventLoopRuntimeListener
+{
+	HevEventLoopRuntimeListener *next;
+
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	int backlog;
+	HevEventSourceFDsFunc callback;
+	void *data;
+	/* the socket shared by all loops, -1 if each has its own */
+	int fd;
+};
+
+struct _HevEventLoopRuntimeWorker
+{
+	HevEventLoopRuntime *runtime;
+	HevEventLoop *loop;
+	pthread_t thread;
+	unsigned int index;
+	int cpu;
+};
+
+struct _HevEventLoopRuntime
+{
+	unsigned int count;
+	unsigned int listener_count;
+	unsigned int ref_count;
+	bool quit;
+	/* a loop failed to start */
+	bool failed;
+
+	pthread_mutex_t mutex;
+	HevEventLoopRuntimeFunc init;
+	HevEventLoopRuntimeFunc fini;
+	void *data;
+
+	HevEventLoopRuntimeListener *listeners;
+	HevEventLoopRuntimeWorker *workers;
+};
+
+HevEventLoopRuntime *
+hev_event_loop_runtime_new (unsigned int count,
+			HevEventLoopRuntimeFunc init, HevEventLoopRuntimeFunc fini, void *data)
+{
+	HevEventLoopRuntime *self = NULL;
+	unsigned int i = 0, cpus = 0;
+	cpu_set_t set;
+	int cpu = -1;
+
+	/* spread over the cpus we are allowed to run on */
+	CPU_ZERO (&set);
+	if (0 == sched_getaffinity (0, sizeof (set), &set))
+	  cpus = CPU_COUNT (&set);
+	if (0 == count)
+	  count = cpus ? cpus : 1;
+
+	self = HEV_MEMORY_ALLOCATOR_ALLOC (sizeof (HevEventLoopRuntime));
+	if (!self)
+	  return NULL;
+
+	self->workers = HEV_MEMORY_ALLOCATOR_ALLOC (sizeof (HevEventLoopRuntimeWorker) * count);
+	if (!self->workers) {
+		HEV_MEMORY_ALLOCATOR_FREE (self);
+		return NULL;
+	}
+
+	for (i=0; i<count; i++) {
+		HevEventLoopRuntimeWorker *worker = &self->workers[i];
+
+		worker->runtime = self;
+		worker->loop = NULL;
+		worker->index = i;
+		worker->cpu = -1;
+		if (cpus) {
+			do {
+				cpu = (cpu + 1) % CPU_SETSIZE;
+			} while (!CPU_ISSET (cpu, &set));
+			worker->cpu = cpu;
+		}
+	}
+
+	self->count = count;
+	self->listener_count = 0;
+	self->ref_count = 1;
+	self->quit = false;
+	self->failed = false;
+	pthread_mutex_init (&self->mutex, NULL);
+	self->init = init;
+	self->fini = fini;
+	self->data = data;
+	self->listeners = NULL;
+
+	return self;
+}
+
+HevEventLoopRuntime *
+hev_event_loop_runtime_ref (HevEventLoopRuntime *self)
+{
+	if (self) {
+		self->ref_count ++;
+		return self;
+	}
+
+	return NULL;
+}
+
+void
+hev_event_loop_runtime_unref (HevEventLoopRuntime *self)
+{
+	if (!self)
+	  return;
+
+	self->ref_count --;
+	if (0 < self->ref_count)
+	  return;
+
+	while (self->listeners) {
+		HevEventLoopRuntimeListener *listener = self->listeners;
+		self->listeners = listener->next;
+		if (0 <= listener->fd)
+		  close (listener->fd);
+		HEV_MEMORY_ALLOCATOR_FREE (listener);
+	}
+	pthread_mutex_destroy (&self->mutex);
+	HEV_MEMORY_ALLOCATOR_FREE (self->workers);
+	HEV_MEMORY_ALLOCATOR_FREE (self);
+}
+
+unsigned int
+hev_event_loop_runtime_get_count (HevEventLoopRuntime *self)
+{
+	return self->count;
+}
+
+static int
+listener_socket_new (HevEventLoopRuntimeListener *listener, bool reuseport)
+{
+	int fd = -1, on = 1;
+
+	fd = socket (listener->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (0 > fd)
+	  return -1;
+
+	/* with reuseport, the kernel balances connections over the loops' sockets */
+	setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on));
+	if ((reuseport && (0 > setsockopt (fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof (on)))) ||
+		(0 > bind (fd, (struct sockaddr *) &listener->addr, listener->addr_len)) ||
+		(0 > listen (fd, listener->backlog))) {
+		close (fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static bool
+listener_add (HevEventLoopRuntime *self, const struct sockaddr *addr,
+			socklen_t addr_len, int backlog, HevEventSourceFDsFunc callback,
+			void *data, bool shared)
+{
+	HevEventLoopRuntimeListener *listener = NULL;
+
+	if (sizeof (listener->addr) < addr_len)
+	  return false;
+
+	listener = HEV_MEMORY_ALLOCATOR_ALLOC (sizeof (HevEventLoopRuntimeListener));
+	if (!listener)
+	  return false;
+
+	memcpy (&listener->addr, addr, addr_len);
+	listener->addr_len = addr_len;
+	listener->backlog = backlog;
+	listener->callback = callback;
+	listener->data = data;
+	listener->fd = -1;
+	if (shared) {
+		listener->fd = listener_socket_new (listener, false);
+		if (0 > listener->fd) {
+			HEV_MEMORY_ALLOCATOR_FREE (listener);
+			return false;
+		}
+	}
+	listener->next = self->listeners;
+	self->listeners = listener;
+	self->listener_count ++;
+
+	return true;
+}
+
+bool
+hev_event_loop_runtime_add_listener (HevEventLoopRuntime *self,
+			const struct sockaddr *addr, socklen_t addr_len, int backlog,
+			HevEventSourceFDsFunc callback, void *data)
+{
+	return listener_add (self, addr, addr_len, backlog, callback, data, false);
+}
+
+bool
+hev_event_loop_runtime_add_shared_listener (HevEventLoopRuntime *self,
+			const struct sockaddr *addr, socklen_t addr_len, int backlog,
+			HevEventSourceFDsFunc callback, void *data)
+{
+	return listener_add (self, addr, addr_len, backlog, callback, data, true);
+}
+
+static void
+quit_handler (void *data)
+{
+	hev_event_loop_quit (data);
+}
+
+/* The listeners' sources, with the sockets of this loop in fds (-1 for a
+ * shared one), the loop unwinds the sources added when it fails. */
+static bool
+worker_listen (HevEventLoopRuntime *self, HevEventLoop *loop, int *fds)
+{
+	HevEventLoopRuntimeListener *listener = NULL;
+	unsigned int i = 0;
+
+	for (i=0; i<self->listener_count; i++)
+	  fds[i] = -1;
+
+	for (listener=self->listeners, i=0; listener; listener=listener->next, i++) {
+		HevEventSource *source = NULL;
+		uint32_t events = EPOLLIN | EPOLLET;
+		int fd = listener->fd;
+
+		if (0 <= fd) {
+			/* one loop woken per connection, not all of them */
+			events |= EPOLLEXCLUSIVE;
+		} else {
+			/* e.g. the port taken by a socket without SO_REUSEPORT */
+			fd = fds[i] = listener_socket_new (listener, true);
+			if (0 > fd)
+			  return false;
+		}
+		source = hev_event_source_fds_new ();
+		if (!source)
+		  return false;
+		if (!hev_event_source_add_fd (source, fd, events)) {
+			hev_event_source_unref (source);
+			return false;
+		}
+		hev_event_source_set_callback (source, (HevEventSourceFunc) listener->callback,
+					listener->data, NULL);
+		hev_event_loop_add_source (loop, source);
+		hev_event_source_unref (source);
+	}
+
+	return true;
+}
+
+static void *
+worker_thread_handler (void *data)
+{
+	HevEventLoopRuntimeWorker *worker = data;
+	HevEventLoopRuntime *self = worker->runtime;
+	HevMemoryAllocator *allocator = NULL;
+	HevEventLoop *loop = NULL;
+	int *fds = NULL;
+	unsigned int i = 0;
+	bool quit = false;
+
+	if (0 <= worker->cpu) {
+		cpu_set_t set;
+		CPU_ZERO (&set);
+		CPU_SET (worker->cpu, &set);
+		sched_setaffinity (0, sizeof (set), &set);
+	}
+
+	/* everything of this loop is allocated and freed on this thread */
+	allocator = hev_memory_allocator_slice_new ();
+	if (allocator)
+	  hev_memory_allocator_set_default (allocator);
+
+	loop = hev_event_loop_new ();
+	if (!loop)
+	  goto quit;
+
+	/* without its listeners, the loop is as good as failed to start */
+	if (self->listener_count) {
+		fds = HEV_MEMORY_ALLOCATOR_ALLOC (sizeof (int) * self->listener_count);
+		if (!fds || !worker_listen (self, loop, fds)) {
+			hev_event_loop_unref (loop);
+			loop = NULL;
+			goto close_fds;
+		}
+	}
+
+	if (self->init)
+	  self->init (loop, worker->index, self->data);
+
+	/* publish the loop, a quit may have been requested meanwhile */
+	pthread_mutex_lock (&self->mutex);
+	worker->loop = loop;
+	quit = self->quit;
+	pthread_mutex_unlock (&self->mutex);
+
+	if (!quit)
+	  hev_event_loop_run (loop);
+
+	pthread_mutex_lock (&self->mutex);
+	worker->loop = NULL;
+	pthread_mutex_unlock (&self->mutex);
+
+	if (self->fini)
+	  self->fini (loop, worker->index, self->data);
+
+	hev_event_loop_unref (loop);
+
+close_fds:
+	if (fds) {
+		for (i=0; i<self->listener_count; i++) {
+			if (0 <= fds[i])
+			  close (fds[i]);
+		}
+		HEV_MEMORY_ALLOCATOR_FREE (fds);
+	}
+
+quit:
+	/* a loop that failed to start takes the others down */
+	if (!loop) {
+		pthread_mutex_lock (&self->mutex);
+		self->failed = true;
+		pthread_mutex_unlock (&self->mutex);
+		hev_event_loop_runtime_quit (self);
+	}
+	if (allocator) {
+		hev_memory_allocator_set_default (NULL);
+		hev_memory_allocator_unref (allocator);
+	}
+
+	return NULL;
+}
+
+bool
+hev_event_loop_runtime_run (HevEventLoopRuntime *self)
+{
+	unsigned int i = 0, started = 0;
+
+	for (i=0; i<self->count; i++) {
+		HevEventLoopRuntimeWorker *worker = &self->workers[i];
+		if (0 != pthread_create (&worker->thread, NULL,
+						worker_thread_handler, worker))
+		  break;
+		started ++;
+	}
+
+	if (started < self->count)
+	  hev_event_loop_runtime_quit (self);
+
+	for (i=0; i<started; i++)
+	  pthread_join (self->workers[i].thread, NULL);
+
+	return (started == self->count) && !self->failed;
+}
+
+void
+hev_event_loop_runtime_quit (HevEventLoopRuntime *self)
+{
+	unsigned int i = 0;
+
+	pthread_mutex_lock (&self->mutex);
+	self->quit = true;
+	for (i=0; i<self->count; i++) {
+		HevEventLoop *loop = self->workers[i].loop;
+		if (loop)
+		  hev_event_loop_invoke (loop, quit_handler, loop);
+	}
+	pthread_mutex_unlock (&self->mutex);
+}
+
@@ -0,0 +1,54 @@
+/*
+ ============================================================================
+ Name        : hev-event-loop-runtime.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2013 everyone.
+ Description : Event loops on multiple cores
+ ============================================================================
+ */
+
+#ifndef __HEV_EVENT_LOOP_RUNTIME_H__
+#define __HEV_EVENT_LOOP_RUNTIME_H__
+
+#include <stdbool.h>
+#include <sys/socket.h>
+
+#include "hev-event-loop.h"
+#include "hev-event-source-fds.h"
+
+typedef struct _HevEventLoopRuntime HevEventLoopRuntime;
+typedef void (*HevEventLoopRuntimeFunc) (HevEventLoop *loop, unsigned int index, void *data);
+
+/* count loops (0 for one per online cpu), each on its own pinned thread
+ * with its own slice allocator as the thread's default. init is called
+ * on every loop thread before the loop runs, fini after it quits. */
+HevEventLoopRuntime * hev_event_loop_runtime_new (unsigned int count,
+			HevEventLoopRuntimeFunc init, HevEventLoopRuntimeFunc fini, void *data);
+
+HevEventLoopRuntime * hev_event_loop_runtime_ref (HevEventLoopRuntime *self);
+void hev_event_loop_runtime_unref (HevEventLoopRuntime *self);
+
+unsigned int hev_event_loop_runtime_get_count (HevEventLoopRuntime *self);
+
+/* Every loop gets its own SO_REUSEPORT socket bound to addr, watched by
+ * a fds source calling callback. Must be called before run. */
+bool hev_event_loop_runtime_add_listener (HevEventLoopRuntime *self,
+			const struct sockaddr *addr, socklen_t addr_len, int backlog,
+			HevEventSourceFDsFunc callback, void *data);
+/* One socket bound to addr now, shared by the loops, each watching it
+ * with EPOLLIN | EPOLLEXCLUSIVE so that a connection wakes one loop, not
+ * all. For when the port can't be sharded with SO_REUSEPORT; the callback
+ * sees EAGAIN when another loop took the connection. Must be called
+ * before run. */
+bool hev_event_loop_runtime_add_shared_listener (HevEventLoopRuntime *self,
+			const struct sockaddr *addr, socklen_t addr_len, int backlog,
+			HevEventSourceFDsFunc callback, void *data);
+
+/* Starts all loops and blocks until every one of them has quit, false if
+ * any failed to start, e.g. could not listen, which quits the others. */
+bool hev_event_loop_runtime_run (HevEventLoopRuntime *self);
+/* Quits all loops, may be called from any thread. */
+void hev_event_loop_runtime_quit (HevEventLoopRuntime *self);
+
+#endif /* __HEV_EVENT_LOOP_RUNTIME_H__ */
+
@@ -0,0 +1,126 @@
+/*
+ ============================================================================
+ Name        : hev-event-loop-trace.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2013 everyone.
+ Description : An event loop trace ring
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "hev-event-loop-trace.h"
+
+static const char *trace_type_names[] =
+{
+	[HEV_EVENT_LOOP_TRACE_WAIT] = "wait",
+	[HEV_EVENT_LOOP_TRACE_CHECK] = "check",
+	[HEV_EVENT_LOOP_TRACE_DISPATCH] = "dispatch",
+	[HEV_EVENT_LOOP_TRACE_PREPARE] = "prepare",
+};
+
+HevEventLoopTrace *
+hev_event_loop_trace_new (unsigned int size)
+{
+	HevEventLoopTrace *self = NULL;
+	uint64_t count = 2;
+
+	while (count < size)
+	  count <<= 1;
+
+	self = HEV_MEMORY_ALLOCATOR_ALLOC (sizeof (HevEventLoopTrace) +
+				sizeof (HevEventLoopTraceRecord) * count);
+	if (self) {
+		self->head = 0;
+		self->mask = count - 1;
+		/* the loop's thread */
+		self->tid = syscall (__NR_gettid);
+	}
+
+	return self;
+}
+
+void
+hev_event_loop_trace_free (HevEventLoopTrace *self)
+{
+	HEV_MEMORY_ALLOCATOR_FREE (self);
+}
+
+static void
+write_name (FILE *fp, const char *name)
+{
+	for (; *name; name++) {
+		if (('"' == *name) || ('\\' == *name))
+		  fprintf (fp, "\\%c", *name);
+		else if (0x20 > (unsigned char) *name)
+		  fprintf (fp, "\\u%04x", *name);
+		else
+		  fputc (*name, fp);
+	}
+}
+
+bool
+hev_event_loop_trace_dump (HevEventLoopTrace *self, int fd)
+{
+	HevEventLoopTraceRecord *records = NULL;
+	uint64_t size = self->mask + 1;
+	uint64_t begin, end, i;
+	unsigned int depth = 0;
+	bool first = true;
+	FILE *fp = NULL;
+	int pid = getpid ();
+
+	/* may run on another thread, its default allocator is not ours */
+	records = malloc (sizeof (HevEventLoopTraceRecord) * size);
+	if (!records)
+	  return false;
+
+	end = __atomic_load_n (&self->head, __ATOMIC_ACQUIRE);
+	begin = (end > size) ? end - size : 0;
+	for (i=begin; i<end; i++)
+	  records[i & self->mask] = self->records[i & self->mask];
+	/* records the writer may have reused while we copied are torn */
+	__atomic_thread_fence (__ATOMIC_ACQUIRE);
+	i = __atomic_load_n (&self->head, __ATOMIC_RELAXED);
+	if ((i + 1) > (begin + size))
+	  begin = i + 1 - size;
+
+	fd = dup (fd);
+	if (0 > fd || !(fp = fdopen (fd, "w"))) {
+		if (0 <= fd)
+		  close (fd);
+		free (records);
+		return false;
+	}
+
+	fprintf (fp, "{\"traceEvents\":[");
+	for (i=begin; i<end; i++) {
+		HevEventLoopTraceRecord *record = &records[i & self->mask];
+
+		/* the begin of an end may have been overwritten */
+		if (!record->begin && !depth)
+		  continue;
+		depth += record->begin ? 1 : -1;
+
+		fprintf (fp, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu.%03u,"
+					"\"pid\":%d,\"tid\":%ld", first ? "" : ",",
+					trace_type_names[record->type], record->begin ? 'B' : 'E',
+					(unsigned long long) (record->time / 1000),
+					(unsigned int) (record->time % 1000), pid, self->tid);
+		if (record->begin && (HEV_EVENT_LOOP_TRACE_WAIT != record->type)) {
+			fprintf (fp, ",\"args\":{\"source\":\"");
+			write_name (fp, record->name);
+			fprintf (fp, "\",\"fd\":%d}", record->fd);
+		}
+		fputc ('}', fp);
+		first = false;
+	}
+	fprintf (fp, "\n]}\n");
+
+	free (records);
+	return (0 == fclose (fp));
+}
+
@@ -0,0 +1,82 @@
+/*
+ ============================================================================
+ Name        : hev-event-loop-trace.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2013 everyone.
+ Description : An event loop trace ring
+ ============================================================================
+ */
+
+#ifndef __HEV_EVENT_LOOP_TRACE_H__
+#define __HEV_EVENT_LOOP_TRACE_H__
+
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hev-event-source.h"
+
+#define HEV_EVENT_LOOP_TRACE_NAME_SIZE	(24)
+
+typedef struct _HevEventLoopTrace HevEventLoopTrace;
+typedef struct _HevEventLoopTraceRecord HevEventLoopTraceRecord;
+typedef enum _HevEventLoopTraceType HevEventLoopTraceType;
+
+enum _HevEventLoopTraceType
+{
+	HEV_EVENT_LOOP_TRACE_WAIT,
+	HEV_EVENT_LOOP_TRACE_CHECK,
+	HEV_EVENT_LOOP_TRACE_DISPATCH,
+	HEV_EVENT_LOOP_TRACE_PREPARE,
+};
+
+struct _HevEventLoopTraceRecord
+{
+	uint64_t time;
+	int fd;
+	uint8_t type;
+	uint8_t begin;
+	/* of the source, copied as it may be gone when the ring is dumped */
+	char name[HEV_EVENT_LOOP_TRACE_NAME_SIZE];
+};
+
+struct _HevEventLoopTrace
+{
+	/* records written so far, only the last mask + 1 are kept */
+	uint64_t head;
+	uint64_t mask;
+	long tid;
+
+	HevEventLoopTraceRecord records[];
+};
+
+/* size is rounded up to a power of two. */
+HevEventLoopTrace * hev_event_loop_trace_new (unsigned int size);
+void hev_event_loop_trace_free (HevEventLoopTrace *self);
+
+/* Writes the kept records as Chrome trace JSON, may be called from any
+ * thread while the loop thread keeps recording. */
+bool hev_event_loop_trace_dump (HevEventLoopTrace *self, int fd);
+
+/* Only called by the loop's thread, readers check head before and after
+ * copying records to drop those overwritten meanwhile. */
+static inline void
+hev_event_loop_trace_record (HevEventLoopTrace *self, uint64_t time,
+			HevEventLoopTraceType type, bool begin, HevEventSource *source, int fd)
+{
+	uint64_t head = self->head;
+	HevEventLoopTraceRecord *record = &self->records[head & self->mask];
+
+	record->time = time;
+	record->fd = fd;
+	record->type = type;
+	record->begin = begin;
+	record->name[0] = '\0';
+	if (source && source->name)
+	  strncpy (record->name, source->name, HEV_EVENT_LOOP_TRACE_NAME_SIZE - 1);
+	record->name[HEV_EVENT_LOOP_TRACE_NAME_SIZE - 1] = '\0';
+	__atomic_store_n (&self->head, head + 1, __ATOMIC_RELEASE);
+}
+
+#endif /* __HEV_EVENT_LOOP_TRACE_H__ */
+
@@ -0,0 +1,631 @@
+/*
+ ============================================================================
+ Name        : hev-event-loop-uring.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2013 everyone.
+ Description : An event loop io_uring backend
+ ============================================================================
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#include "hev-event-loop-uring.h"
+
+#if defined(IORING_POLL_ADD_MULTI) && defined(__NR_io_uring_setup)
+
+#define SQ_ENTRIES	(256)
+#define CQ_ENTRIES	(4096)
+
+/* user_data of I/O requests is tagged, of polls it is the bare fd,
+ * 0 is for completions nobody waits for, USER_DATA_PROBE for the probe's
+ * poll */
+#define USER_DATA_IO	(1)
+#define USER_DATA_PROBE	(2)
+
+/* ns the probe waits for a completion */
+#define PROBE_TIMEOUT	(1000000000)
+
+typedef struct _HevEventLoopUringIO HevEventLoopUringIO;
+
+struct _HevEventLoopUringIO
+{
+	HevEventLoopUringIO *prev;
+	HevEventLoopUringIO *next;
+
+	HevEventLoopIOFunc func;
+	void *data;
+};
+
+struct _HevEventLoopUring
+{
+	int fd;
+	unsigned int polls;
+	unsigned int ios;
+
+	unsigned int sq_mask;
+	unsigned int sq_entries;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_flags;
+	struct io_uring_sqe *sqes;
+
+	unsigned int cq_mask;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	struct io_uring_cqe *cqes;
+
+	void *ring;
+	size_t ring_size;
+	size_t sqes_size;
+
+	HevEventLoopUringIO *io_list;
+};
+
+static inline int
+io_uring_setup (unsigned int entries, struct io_uring_params *params)
+{
+	return syscall (__NR_io_uring_setup, entries, params);
+}
+
+static inline int
+io_uring_enter (int fd, unsigned int to_submit, unsigned int min_complete,
+			unsigned int flags, void *arg, size_t size)
+{
+	return syscall (__NR_io_uring_enter, fd, to_submit, min_complete,
+				flags, arg, size);
+}
+
+static inline unsigned int
+sq_pending (HevEventLoopUring *self)
+{
+	return *self->sq_tail - __atomic_load_n (self->sq_head, __ATOMIC_ACQUIRE);
+}
+
+static inline unsigned int
+cq_ready (HevEventLoopUring *self)
+{
+	return __atomic_load_n (self->cq_tail, __ATOMIC_ACQUIRE) - *self->cq_head;
+}
+
+static int
+enter (HevEventLoopUring *self, unsigned int min_complete,
+			unsigned int flags, int64_t timeout)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+
+	memset (&arg, 0, sizeof (arg));
+	arg.sigmask_sz = _NSIG / 8;
+	if (0 < timeout) {
+		ts.tv_sec = timeout / 1000000000;
+		ts.tv_nsec = timeout % 1000000000;
+		arg.ts = (uint64_t) (uintptr_t) &ts;
+	}
+
+	return io_uring_enter (self->fd, sq_pending (self), min_complete,
+				flags | IORING_ENTER_EXT_ARG, &arg, sizeof (arg));
+}
+
+/* SQEs are only read by the kernel in io_uring_enter, fill in place */
+static struct io_uring_sqe *
+get_sqe (HevEventLoopUring *self)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int tail = *self->sq_tail;
+
+	if (sq_pending (self) >= self->sq_entries) {
+		/* full, submit without waiting */
+		enter (self, 0, 0, 0);
+		if (sq_pending (self) >= self->sq_entries)
+		  return NULL;
+	}
+
+	sqe = &self->sqes[tail & self->sq_mask];
+	memset (sqe, 0, sizeof (struct io_uring_sqe));
+
+	return sqe;
+}
+
+static inline void
+commit_sqe (HevEventLoopUring *self)
+{
+	__atomic_store_n (self->sq_tail, *self->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t
+poll_mask (uint32_t events)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	events = (events << 16) | (events >> 16);
+#endif
+	return events;
+}
+
+/* multishot poll needs linux 5.13, older kernels fail it with EINVAL.
+ * The probe's poll ends here, the completions tagged USER_DATA_PROBE
+ * are all reaped before returning. */
+static bool
+probe_multishot_poll (HevEventLoopUring *self)
+{
+	struct io_uring_sqe *sqe;
+	bool supported = false, first = true, removing = false;
+	int fd = -1;
+
+	fd = eventfd (1, EFD_NONBLOCK);
+	if (0 > fd)
+	  return false;
+
+	sqe = get_sqe (self);
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = poll_mask (POLLIN);
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->user_data = USER_DATA_PROBE;
+	commit_sqe (self);
+
+	for (;;) {
+		struct io_uring_cqe *cqe;
+		uint64_t user_data;
+		uint32_t flags;
+		int32_t res;
+
+		if (!cq_ready (self) &&
+					(0 > enter (self, 1, IORING_ENTER_GETEVENTS, PROBE_TIMEOUT)) &&
+					(EINTR != errno))
+		  break;
+		if (!cq_ready (self))
+		  continue;
+
+		cqe = &self->cqes[*self->cq_head & self->cq_mask];
+		user_data = cqe->user_data;
+		flags = cqe->flags;
+		res = cqe->res;
+		__atomic_store_n (self->cq_head, *self->cq_head + 1, __ATOMIC_RELEASE);
+		/* the remove's own, user_data 0 */
+		if (USER_DATA_PROBE != user_data)
+		  continue;
+
+		if (first) {
+			supported = (0 < res) && (IORING_CQE_F_MORE & flags);
+			first = false;
+		}
+		/* the poll's last completion */
+		if (!(IORING_CQE_F_MORE & flags))
+		  break;
+		if (!removing) {
+			sqe = get_sqe (self);
+			sqe->opcode = IORING_OP_POLL_REMOVE;
+			sqe->addr = USER_DATA_PROBE;
+			commit_sqe (self);
+			removing = true;
+		}
+	}
+	close (fd);
+
+	return supported;
+}
+
+HevEventLoopUring *
+hev_event_loop_uring_new (void)
+{
+	HevEventLoopUring *self = NULL;
+	struct io_uring_params params;
+	size_t sq_size, cq_size;
+	unsigned int i;
+	int fd = -1;
+
+	memset (&params, 0, sizeof (params));
+	params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+	params.cq_entries = CQ_ENTRIES;
+	fd = io_uring_setup (SQ_ENTRIES, &params);
+	if (0 > fd)
+	  return NULL;
+
+	/* single mmap (5.4), ext arg (5.11) for timeouts, no dropped cqes */
+	if (!(IORING_FEAT_SINGLE_MMAP & params.features) ||
+				!(IORING_FEAT_NODROP & params.features) ||
+				!(IORING_FEAT_EXT_ARG & params.features))
+	  goto close;
+
+	self = HEV_MEMORY_ALLOCATOR_ALLOC (sizeof (HevEventLoopUring));
+	if (!self)
+	  goto close;
+
+	sq_size = params.sq_off.array + params.sq_entries * sizeof (unsigned int);
+	cq_size = params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe);
+	self->ring_size = (sq_size > cq_size) ? sq_size : cq_size;
+	self->ring = mmap (NULL, self->ring_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (MAP_FAILED == self->ring)
+	  goto free;
+
+	self->sqes_size = params.sq_entries * sizeof (struct io_uring_sqe);
+	self->sqes = mmap (NULL, self->sqes_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (MAP_FAILED == self->sqes)
+	  goto unmap;
+
+	self->fd = fd;
+	self->polls = 0;
+	self->ios = 0;
+	self->io_list = NULL;
+	self->sq_mask = *(unsigned int *) (self->ring + params.sq_off.ring_mask);
+	self->sq_entries = params.sq_entries;
+	self->sq_head = self->ring + params.sq_off.head;
+	self->sq_tail = self->ring + params.sq_off.tail;
+	self->sq_flags = self->ring + params.sq_off.flags;
+	self->cq_mask = *(unsigned int *) (self->ring + params.cq_off.ring_mask);
+	self->cq_head = self->ring + params.cq_off.head;
+	self->cq_tail = self->ring + params.cq_off.tail;
+	self->cqes = self->ring + params.cq_off.cqes;
+
+	/* sqe i always sits in array slot i */
+	for (i=0; i<params.sq_entries; i++) {
+		unsigned int *array = self->ring + params.sq_off.array;
+		array[i] = i;
+	}
+
+	if (probe_multishot_poll (self))
+	  return self;
+
+	munmap (self->sqes, self->sqes_size);
+unmap:
+	munmap (self->ring, self->ring_size);
+free:
+	HEV_MEMORY_ALLOCATOR_FREE (self);
+close:
+	close (fd);
+
+	return NULL;
+}
+
+void
+hev_event_loop_uring_free (HevEventLoopUring *self)
+{
+	HevEventLoopUringIO *io;
+	unsigned int tries = 0;
+
+	for (io=self->io_list; io; io=io->next) {
+		struct io_uring_sqe *sqe = get_sqe (self);
+		if (!sqe)
+		  break;
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr = (uintptr_t) io | USER_DATA_IO;
+		commit_sqe (self);
+	}
+
+	/* the kernel may still write to buffers until each completion */
+	while ((self->polls || self->ios) && (tries < 10)) {
+		if (0 > hev_event_loop_uring_wait (self, 100) && (EINTR != errno))
+		  break;
+		if (0 == hev_event_loop_uring_reap (self, NULL, NULL))
+		  tries ++;
+	}
+
+	munmap (self->sqes, self->sqes_size);
+	munmap (self->ring, self->ring_size);
+	close (self->fd);
+	HEV_MEMORY_ALLOCATOR_FREE (self);
+}
+
+int
+hev_event_loop_uring_get_fd (HevEventLoopUring *self)
+{
+	return self->fd;
+}
+
+bool
+hev_event_loop_uring_add_fd (HevEventLoopUring *self, HevEventSourceFD *fd)
+{
+	struct io_uring_sqe *sqe = get_sqe (self);
+
+	if (!sqe)
+	  return false;
+
+	/* multishot polls are edge triggered; level triggered fds get single
+	 * shot polls armed again after each event, oneshot ones by mod_fd;
+	 * polls have no exclusive wakeups, every loop gets the event */
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd->fd;
+	sqe->poll32_events = poll_mask (fd->_events & ~(EPOLLET | EPOLLONESHOT | EPOLLEXCLUSIVE));
+	if (HEV_EVENT_SOURCE_FD_TRIGGER_EDGE == fd->_trigger)
+	  sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->user_data = (uintptr_t) fd;
+	commit_sqe (self);
+
+	/* the poll keeps fd alive until its last completion */
+	_hev_event_source_fd_ref (fd);
+	fd->_armed ++;
+	self->polls ++;
+
+	return true;
+}
+
+bool
+hev_event_loop_uring_del_fd (HevEventLoopUring *self, HevEventSourceFD *fd)
+{
+	struct io_uring_sqe *sqe;
+
+	if (!fd->_armed)
+	  return true;
+
+	sqe = get_sqe (self);
+	if (!sqe)
+	  return false;
+
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->addr = (uintptr_t) fd;
+	commit_sqe (self);
+
+	return true;
+}
+
+bool
+hev_event_loop_uring_mod_fd (HevEventLoopUring *self, HevEventSourceFD *fd)
+{
+	/* submitted in order, the remove only finds the old poll */
+	if (!hev_event_loop_uring_del_fd (self, fd))
+	  return false;
+
+	return hev_event_loop_uring_add_fd (self, fd);
+}
+
+static struct io_uring_sqe *
+io_sqe_new (HevEventLoopUring *self, HevEventLoopIOFunc func, void *data)
+{
+	struct io_uring_sqe *sqe = NULL;
+	HevEventLoopUringIO *io = NULL;
+
+	sqe = get_sqe (self);
+	if (!sqe)
+	  return NULL;
+
+	io = HEV_MEMORY_ALLOCATOR_ALLOC (sizeof (HevEventLoopUringIO));
+	if (!io)
+	  return NULL;
+
+	io->func = func;
+	io->data = data;
+	io->prev = NULL;
+	io->next = self->io_list;
+	if (self->io_list)
+	  self->io_list->prev = io;
+	self->io_list = io;
+	self->ios ++;
+
+	sqe->user_data = (uintptr_t) io | USER_DATA_IO;
+
+	return sqe;
+}
+
+bool
+hev_event_loop_uring_read (HevEventLoopUring *self, int fd, void *buf,
+			size_t len, HevEventLoopIOFunc func, void *data)
+{
+	struct io_uring_sqe *sqe = io_sqe_new (self, func, data);
+
+	if (!sqe)
+	  return false;
+
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t) buf;
+	sqe->len = len;
+	sqe->off = (uint64_t) -1;
+	commit_sqe (self);
+
+	return true;
+}
+
+bool
+hev_event_loop_uring_write (HevEventLoopUring *self, int fd, const void *buf,
+			size_t len, HevEventLoopIOFunc func, void *data)
+{
+	struct io_uring_sqe *sqe = io_sqe_new (self, func, data);
+
+	if (!sqe)
+	  return false;
+
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t) buf;
+	sqe->len = len;
+	sqe->off = (uint64_t) -1;
+	commit_sqe (self);
+
+	return true;
+}
+
+bool
+hev_event_loop_uring_accept (HevEventLoopUring *self, int fd, struct sockaddr *addr,
+			socklen_t *addr_len, HevEventLoopIOFunc func, void *data)
+{
+	struct io_uring_sqe *sqe = io_sqe_new (self, func, data);
+
+	if (!sqe)
+	  return false;
+
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t) addr;
+	sqe->addr2 = (uintptr_t) addr_len;
+	sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	commit_sqe (self);
+
+	return true;
+}
+
+int
+hev_event_loop_uring_wait (HevEventLoopUring *self, int64_t timeout)
+{
+	unsigned int flags = 0, min_complete = 0;
+	bool overflow = IORING_SQ_CQ_OVERFLOW & __atomic_load_n (self->sq_flags,
+				__ATOMIC_RELAXED);
+
+	/* completions are already there, only submit */
+	if (cq_ready (self))
+	  timeout = 0;
+
+	if (timeout) {
+		flags = IORING_ENTER_GETEVENTS;
+		min_complete = 1;
+	} else if (overflow) {
+		flags = IORING_ENTER_GETEVENTS;
+	} else if (!sq_pending (self)) {
+		return cq_ready (self);
+	}
+
+	if (0 > enter (self, min_complete, flags, timeout)) {
+		switch (errno) {
+		case ETIME:
+		case EBUSY:
+		case EAGAIN:
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	return cq_ready (self);
+}
+
+unsigned int
+hev_event_loop_uring_reap (HevEventLoopUring *self,
+			HevEventLoopUringFunc func, void *data)
+{
+	unsigned int count = 0;
+
+	while (cq_ready (self)) {
+		struct io_uring_cqe *cqe = &self->cqes[*self->cq_head & self->cq_mask];
+		uint64_t user_data = cqe->user_data;
+		uint32_t flags = cqe->flags;
+		int32_t res = cqe->res;
+
+		__atomic_store_n (self->cq_head, *self->cq_head + 1, __ATOMIC_RELEASE);
+		count ++;
+
+		/* late ones of the probe if it timed out, polls are pointers */
+		if (!user_data || (USER_DATA_PROBE == user_data))
+		  continue;
+
+		if (USER_DATA_IO & user_data) {
+			HevEventLoopUringIO *io = (void *) (uintptr_t) (user_data & ~USER_DATA_IO);
+
+			if (io->prev)
+			  io->prev->next = io->next;
+			else
+			  self->io_list = io->next;
+			if (io->next)
+			  io->next->prev = io->prev;
+			self->ios --;
+			io->func (res, io->data);
+			HEV_MEMORY_ALLOCATOR_FREE (io);
+		} else {
+			HevEventSourceFD *fd = (void *) (uintptr_t) user_data;
+			bool last = !(IORING_CQE_F_MORE & flags);
+
+			/* a poll that ended with an event, not removed or failed */
+			if (last) {
+				fd->_armed --;
+				self->polls --;
+				if (fd->_registered && !fd->_armed && (0 <= res) &&
+							(HEV_EVENT_SOURCE_FD_TRIGGER_ONESHOT != fd->_trigger))
+				  hev_event_loop_uring_add_fd (self, fd);
+			}
+			if ((0 < res) && fd->_registered && func)
+			  func (fd, res, data);
+			if (last)
+			  _hev_event_source_fd_unref (fd);
+		}
+	}
+
+	return count;
+}
+
+#else /* no io_uring */
+
+HevEventLoopUring *
+hev_event_loop_uring_new (void)
+{
+	return NULL;
+}
+
+void
+hev_event_loop_uring_free (HevEventLoopUring *self)
+{
+}
+
+int
+hev_event_loop_uring_get_fd (HevEventLoopUring *self)
+{
+	return -1;
+}
+
+bool
+hev_event_loop_uring_add_fd (HevEventLoopUring *self, HevEventSourceFD *fd)
+{
+	return false;
+}
+
+bool
+hev_event_loop_uring_del_fd (HevEventLoopUring *self, HevEventSourceFD *fd)
+{
+	return false;
+}
+
+bool
+hev_event_loop_uring_mod_fd (HevEventLoopUring *self, HevEventSourceFD *fd)
+{
+	return false;
+}
+
+bool
+hev_event_loop_uring_read (HevEventLoopUring *self, int fd, void *buf,
+			size_t len, HevEventLoopIOFunc func, void *data)
+{
+	return false;
+}
+
+bool
+hev_event_loop_uring_write (HevEventLoopUring *self, int fd, const void *buf,
+			size_t len, HevEventLoopIOFunc func, void *data)
+{
+	return false;
+}
+
+bool
+hev_event_loop_uring_accept (HevEventLoopUring *self, int fd, struct sockaddr *addr,
+			socklen_t *addr_len, HevEventLoopIOFunc func, void *data)
+{
+	return false;
+}
+
+int
+hev_event_loop_uring_wait (HevEventLoopUring *self, int64_t timeout)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+unsigned int
+hev_event_loop_uring_reap (HevEventLoopUring *self,
+			HevEventLoopUringFunc func, void *data)
+{
+	return 0;
+}
+
+#endif
+
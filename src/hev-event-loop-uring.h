@@ -0,0 +1,49 @@
+/*
+ ============================================================================
+ Name        : hev-event-loop-uring.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2013 everyone.
+ Description : An event loop io_uring backend
+ ============================================================================
+ */
+
+#ifndef __HEV_EVENT_LOOP_URING_H__
+#define __HEV_EVENT_LOOP_URING_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+
+#include "hev-event-loop.h"
+
+typedef struct _HevEventLoopUring HevEventLoopUring;
+typedef void (*HevEventLoopUringFunc) (HevEventSourceFD *fd, uint32_t events, void *data);
+
+/* NULL if the kernel (or the build) has no multishot poll support. */
+HevEventLoopUring * hev_event_loop_uring_new (void);
+/* Cancels all polls and I/O, waits for them, I/O callbacks still run. */
+void hev_event_loop_uring_free (HevEventLoopUring *self);
+
+int hev_event_loop_uring_get_fd (HevEventLoopUring *self);
+
+/* Readiness, reported edge triggered through multishot polls. */
+bool hev_event_loop_uring_add_fd (HevEventLoopUring *self, HevEventSourceFD *fd);
+bool hev_event_loop_uring_del_fd (HevEventLoopUring *self, HevEventSourceFD *fd);
+bool hev_event_loop_uring_mod_fd (HevEventLoopUring *self, HevEventSourceFD *fd);
+
+bool hev_event_loop_uring_read (HevEventLoopUring *self, int fd, void *buf,
+			size_t len, HevEventLoopIOFunc func, void *data);
+bool hev_event_loop_uring_write (HevEventLoopUring *self, int fd, const void *buf,
+			size_t len, HevEventLoopIOFunc func, void *data);
+bool hev_event_loop_uring_accept (HevEventLoopUring *self, int fd, struct sockaddr *addr,
+			socklen_t *addr_len, HevEventLoopIOFunc func, void *data);
+
+/* Submits queued requests and waits up to timeout ns (-1 is forever) for
+ * completions, returns -1 with errno set on failure, like epoll_wait. */
+int hev_event_loop_uring_wait (HevEventLoopUring *self, int64_t timeout);
+/* Runs I/O callbacks and reports ready fds to func, returns the count. */
+unsigned int hev_event_loop_uring_reap (HevEventLoopUring *self,
+			HevEventLoopUringFunc func, void *data);
+
+#endif /* __HEV_EVENT_LOOP_URING_H__ */
+
@@ -0,0 +1,271 @@
+/*
+ ============================================================================
+ Name        : hev-event-loop-watchdog.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2013 everyone.
+ Description : An event loop watchdog
+ ============================================================================
+ */
+
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include <semaphore.h>
+#ifdef __GLIBC__
+#include <execinfo.h>
+#endif
+
+#include "hev-event-loop-watchdog.h"
+
+/* Taken on the loop's thread, to read its fd and stack. */
+#define WATCHDOG_SIGNAL		(SIGRTMAX - 1)
+#define WATCHDOG_BACKTRACE_SIZE	(64)
+
+static void * watchdog_thread_handler (void *data);
+
+/* One report at a time, handed to the signal handler */
+static pthread_once_t report_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t report_mutex = PTHREAD_MUTEX_INITIALIZER;
+static HevEventLoopWatchdog *report_watchdog;
+static uint64_t report_beat;
+static uint64_t report_time;
+static sem_t report_done;
+
+static inline uint64_t
+get_time (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+write_str (int fd, const char *str)
+{
+	size_t len = strlen (str);
+
+	while (len) {
+		ssize_t size = write (fd, str, len);
+		if (0 >= size)
+		  break;
+		str += size;
+		len -= size;
+	}
+}
+
+/* Async signal safe, unlike printf. */
+static void
+write_int (int fd, int64_t value)
+{
+	char buf[24];
+	char *p = buf + sizeof (buf);
+	uint64_t v = (0 > value) ? -value : value;
+
+	*-- p = '\0';
+	do {
+		*-- p = '0' + (v % 10);
+		v /= 10;
+	} while (v);
+	if (0 > value)
+	  *-- p = '-';
+	write_str (fd, p);
+}
+
+static void
+signal_handler (int signo)
+{
+	HevEventLoopWatchdog *self;
+	HevEventSourceFD *fd;
+	int errsv = errno;
+
+	self = __atomic_exchange_n (&report_watchdog, NULL, __ATOMIC_ACQUIRE);
+	if (!self)
+	  return;
+
+	/* the loop may have moved on since */
+	fd = self->fd;
+	if ((__atomic_load_n (&self->beat, __ATOMIC_RELAXED) == report_beat) && fd) {
+		const char *name = "(removed)";
+#ifdef __GLIBC__
+		void *frames[WATCHDOG_BACKTRACE_SIZE];
+		int count;
+#endif
+
+		if (fd->source)
+		  name = fd->source->name ? fd->source->name : "(unnamed)";
+		write_str (self->out_fd, "hev-event-loop: watchdog: source ");
+		write_str (self->out_fd, name);
+		write_str (self->out_fd, " fd ");
+		write_int (self->out_fd, fd->fd);
+		write_str (self->out_fd, " busy for ");
+		write_int (self->out_fd, report_time / 1000000);
+		write_str (self->out_fd, " ms\n");
+#ifdef __GLIBC__
+		count = backtrace (frames, WATCHDOG_BACKTRACE_SIZE);
+		/* skip this handler */
+		if (1 < count)
+		  backtrace_symbols_fd (frames + 1, count - 1, self->out_fd);
+#endif
+	}
+
+	sem_post (&report_done);
+	errno = errsv;
+}
+
+static void
+report_init (void)
+{
+	struct sigaction sa;
+
+#ifdef __GLIBC__
+	void *frames[1];
+
+	/* loads libgcc now, not in the signal handler */
+	backtrace (frames, 1);
+#endif
+	sem_init (&report_done, 0, 0);
+	memset (&sa, 0, sizeof (sa));
+	sa.sa_handler = signal_handler;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset (&sa.sa_mask);
+	sigaction (WATCHDOG_SIGNAL, &sa, NULL);
+}
+
+HevEventLoopWatchdog *
+hev_event_loop_watchdog_new (unsigned int threshold_ms, int out_fd)
+{
+	HevEventLoopWatchdog *self = NULL;
+	pthread_condattr_t attr;
+	sigset_t mask, old_mask;
+	int res;
+
+	pthread_once (&report_once, report_init);
+
+	self = HEV_MEMORY_ALLOCATOR_ALLOC (sizeof (HevEventLoopWatchdog));
+	if (!self)
+	  return NULL;
+
+	self->beat = 1;
+	self->fd = NULL;
+	self->loop_thread = pthread_self ();
+	self->threshold = (uint64_t) threshold_ms * 1000000;
+	self->out_fd = out_fd;
+	self->quit = false;
+	pthread_mutex_init (&self->mutex, NULL);
+	pthread_condattr_init (&attr);
+	pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+	pthread_cond_init (&self->cond, &attr);
+	pthread_condattr_destroy (&attr);
+
+	/* the signals of the process are for the loops, not for the watchdog */
+	sigfillset (&mask);
+	pthread_sigmask (SIG_SETMASK, &mask, &old_mask);
+	res = pthread_create (&self->thread, NULL, watchdog_thread_handler, self);
+	pthread_sigmask (SIG_SETMASK, &old_mask, NULL);
+	if (res) {
+		pthread_cond_destroy (&self->cond);
+		pthread_mutex_destroy (&self->mutex);
+		HEV_MEMORY_ALLOCATOR_FREE (self);
+		return NULL;
+	}
+
+	return self;
+}
+
+void
+hev_event_loop_watchdog_free (HevEventLoopWatchdog *self)
+{
+	pthread_mutex_lock (&self->mutex);
+	self->quit = true;
+	pthread_cond_signal (&self->cond);
+	pthread_mutex_unlock (&self->mutex);
+	pthread_join (self->thread, NULL);
+
+	pthread_cond_destroy (&self->cond);
+	pthread_mutex_destroy (&self->mutex);
+	HEV_MEMORY_ALLOCATOR_FREE (self);
+}
+
+static void
+report (HevEventLoopWatchdog *self, uint64_t beat, uint64_t time)
+{
+	struct timespec ts;
+	bool done = false;
+
+	pthread_mutex_lock (&report_mutex);
+	report_beat = beat;
+	report_time = time;
+	__atomic_store_n (&report_watchdog, self, __ATOMIC_RELEASE);
+
+	if (!pthread_kill (self->loop_thread, WATCHDOG_SIGNAL)) {
+		int res;
+
+		clock_gettime (CLOCK_REALTIME, &ts);
+		ts.tv_sec += 1;
+		while ((res = sem_timedwait (&report_done, &ts)) && (EINTR == errno))
+		  ;
+		done = !res;
+	}
+
+	/* not taken in time (signal blocked?), unless the handler just did */
+	if (!done) {
+		if (__atomic_exchange_n (&report_watchdog, NULL, __ATOMIC_ACQUIRE))
+		  write_str (self->out_fd, "hev-event-loop: watchdog: loop busy, no report\n");
+		else
+		  while (sem_wait (&report_done) && (EINTR == errno))
+		    ;
+	}
+
+	pthread_mutex_unlock (&report_mutex);
+}
+
+static void *
+watchdog_thread_handler (void *data)
+{
+	HevEventLoopWatchdog *self = data;
+	uint64_t interval = self->threshold / 4;
+	uint64_t last = 1, since = 0;
+	bool reported = false;
+
+	/* sampling a quarter of the threshold, the busy time is late by that much */
+	if (1000000 > interval)
+	  interval = 1000000;
+
+	pthread_mutex_lock (&self->mutex);
+	while (!self->quit) {
+		uint64_t deadline = get_time () + interval;
+		struct timespec ts = {
+			.tv_sec = deadline / 1000000000,
+			.tv_nsec = deadline % 1000000000,
+		};
+		uint64_t beat, now;
+
+		pthread_cond_timedwait (&self->cond, &self->mutex, &ts);
+		if (self->quit)
+		  break;
+
+		beat = __atomic_load_n (&self->beat, __ATOMIC_RELAXED);
+		now = get_time ();
+		if (beat != last) {
+			last = beat;
+			since = now;
+			reported = false;
+			continue;
+		}
+		/* idle, told already, or not for long */
+		if ((beat & 1) || reported || ((now - since) < self->threshold))
+		  continue;
+
+		reported = true;
+		pthread_mutex_unlock (&self->mutex);
+		report (self, beat, now - since);
+		pthread_mutex_lock (&self->mutex);
+	}
+	pthread_mutex_unlock (&self->mutex);
+
+	return NULL;
+}
+
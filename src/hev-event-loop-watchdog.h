@@ -0,0 +1,51 @@
+/*
+ ============================================================================
+ Name        : hev-event-loop-watchdog.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2013 everyone.
+ Description : An event loop watchdog
+ ============================================================================
+ */
+
+#ifndef __HEV_EVENT_LOOP_WATCHDOG_H__
+#define __HEV_EVENT_LOOP_WATCHDOG_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "hev-event-source.h"
+
+typedef struct _HevEventLoopWatchdog HevEventLoopWatchdog;
+
+struct _HevEventLoopWatchdog
+{
+	/* written by the loop's thread: 2 more each beat, bit 0 set if idle */
+	uint64_t beat;
+	/* being checked, dispatched or prepared, only read on the loop's thread */
+	HevEventSourceFD *volatile fd;
+
+	pthread_t loop_thread;
+	uint64_t threshold;
+	int out_fd;
+
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool quit;
+};
+
+/* Called on the loop's thread, reports to out_fd. */
+HevEventLoopWatchdog * hev_event_loop_watchdog_new (unsigned int threshold_ms, int out_fd);
+void hev_event_loop_watchdog_free (HevEventLoopWatchdog *self);
+
+/* Before each check of a ready fd, and with NULL before waiting. */
+static inline void
+hev_event_loop_watchdog_beat (HevEventLoopWatchdog *self, HevEventSourceFD *fd)
+{
+	self->fd = fd;
+	__atomic_store_n (&self->beat, ((self->beat | 1) + 1) | !fd, __ATOMIC_RELAXED);
+}
+
+#endif /* __HEV_EVENT_LOOP_WATCHDOG_H__ */
+
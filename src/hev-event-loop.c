@@ -7,36 +7,248 @@
  ============================================================================
  */
 
+#include <time.h>
 #include <errno.h>
 #include <stdio.h>
+#include <limits.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 
-#include "hev-slist.h"
 #include "hev-event-loop.h"
+#include "hev-timer-wheel.h"
+#include "hev-event-loop-uring.h"
+#include "hev-event-loop-trace.h"
+#include "hev-event-loop-watchdog.h"
+#include "hev-event-source-signal.h"
+
+#define DISPATCH_BUDGET_DEFAULT	(64)
+
+/* epoll events per wait; an adaptive batch halves after this many waits
+ * in a row filling less than a quarter of it */
+#define EVENT_BATCH_DEFAULT	(256)
+#define EVENT_BATCH_SHRINK_WAITS	(64)
+
+/* statistics are compiled in unless built with HEV_EVENT_LOOP_STATS=0 */
+#ifndef HEV_EVENT_LOOP_STATS
+#define HEV_EVENT_LOOP_STATS	(1)
+#endif
+#define STATS_ENABLED(self)	(HEV_EVENT_LOOP_STATS && (self)->stats_enabled)
+
+/* timers are kept in ticks of the monotonic clock, 65.536 us, fine enough
+ * for sub-millisecond timeouts, the wheel still covers 18 minutes */
+#define TIMER_TICK_NS		(UINT64_C (1) << 16)
+/* distinct deadlines told apart per wakeup, for the stats */
+#define TIMER_DEADLINES_TRACKED	(16)
+
+/* ready fds are queued in one FIFO per priority, priorities outside of
+ * [READY_PRIORITY_MIN, READY_PRIORITY_MAX] share the first or last one. */
+#define READY_LIST_COUNT	(64)
+#define READY_PRIORITY_MIN	(-(READY_LIST_COUNT / 2))
+#define READY_PRIORITY_MAX	(READY_LIST_COUNT / 2 - 1)
+
+/* aging: a ready list gains a priority level per this many dispatches
+ * it waits, so priority i waits at most (63 - i) * SCHED_AGING_STEP */
+#define SCHED_AGING_STEP	(16)
+
+/* epoll busy poll parameters, linux 6.9 */
+#ifndef EPIOCSPARAMS
+struct epoll_params
+{
+	uint32_t busy_poll_usecs;
+	uint16_t busy_poll_budget;
+	uint8_t prefer_busy_poll;
+	uint8_t __pad;
+};
+#define EPIOCSPARAMS		_IOW (0x8A, 0x01, struct epoll_params)
+#endif
+
+/* epoll_wait with a timespec timeout, linux 5.11 */
+#ifndef __NR_epoll_pwait2
+#define __NR_epoll_pwait2	(441)
+#endif
+
+/* HevEventSourceFD::_changed bits */
+#define CHANGE_QUEUED		(1 << 0)
+#define CHANGE_EVENTS		(1 << 1)
+
+typedef struct _HevEventLoopReadyList HevEventLoopReadyList;
+typedef struct _HevEventLoopInvoke HevEventLoopInvoke;
+typedef struct _HevEventSourceInvoke HevEventSourceInvoke;
+
+struct _HevEventLoopReadyList
+{
+	HevEventSourceFD *head;
+	HevEventSourceFD *tail;
+};
+
+struct _HevEventLoopInvoke
+{
+	HevEventLoopInvoke *next;
+	HevEventLoopInvokeFunc func;
+	void *data;
+};
+
+/* cross thread invokes, pushed lock free by any thread, run by the loop */
+struct _HevEventSourceInvoke
+{
+	HevEventSource parent;
+
+	int event_fd;
+	HevEventLoopInvoke *queue;
+};
 
 struct _HevEventLoop
 {
 	int epoll_fd;
 	unsigned int ref_count;
+	unsigned int dispatch_budget;
 
 	bool run;
-	HevSList *sources;
-	HevSList *fd_list;
+	bool defer_changes;
+	bool stats_enabled;
+	HevEventSource *sources;
+	HevEventSourceInvoke *invoke_source;
+	/* the shared signalfd, created with the first signal source */
+	HevEventSource *signal_mux;
+
+	uint64_t time;
+	HevTimerWheel *timer_wheel;
+
+	/* ns, the longest spin and the average time events took to come */
+	uint64_t busy_poll_max;
+	uint64_t busy_poll_gap;
+
+	/* NULL on the epoll backend */
+	HevEventLoopUring *uring;
+
+	uint64_t ready_mask;
+	unsigned int ready_count;
+	HevEventLoopReadyList ready_lists[READY_LIST_COUNT];
+
+	HevEventLoopSchedPolicy sched_policy;
+	uint64_t sched_tick;
+	/* weighted: lists with credits left, list i has i + 1 per round */
+	uint64_t credit_mask;
+	uint8_t credits[READY_LIST_COUNT];
+	/* aging: sched_tick when a list was last served or became ready */
+	uint64_t served_at[READY_LIST_COUNT];
+
+	/* epoll_wait's array, between batch_min and batch_max if adaptive */
+	struct epoll_event *events;
+	unsigned int batch_size;
+	unsigned int batch_min;
+	unsigned int batch_max;
+	unsigned int batch_low_waits;
+
+	/* idle fds to make ready once the ready lists are empty */
+	HevEventSourceFD *idle_head;
+	HevEventSourceFD *idle_tail;
+
+	/* fds with registration changes not applied to epoll yet */
+	HevEventSourceFD *change_head;
+	HevEventSourceFD *change_tail;
+
+	HevEventLoopStats stats;
+	unsigned int timer_deadline_count;
+	uint64_t timer_deadlines[TIMER_DEADLINES_TRACKED];
+	/* NULL unless tracing */
+	HevEventLoopTrace *trace;
+	/* NULL unless watched */
+	HevEventLoopWatchdog *watchdog;
 };
 
+static void ready_lists_clear (HevEventLoop *self);
+static bool flush_changes (HevEventLoop *self);
+static void idle_list_remove (HevEventLoop *self, HevEventSourceFD *fd);
+static HevEventSource * hev_event_source_invoke_new (void);
+
+static inline uint64_t
+get_time (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline void
+update_time (HevEventLoop *self)
+{
+	self->time = get_time ();
+}
+
 HevEventLoop *
 hev_event_loop_new (void)
+{
+	return hev_event_loop_new_full (HEV_EVENT_LOOP_BACKEND_EPOLL);
+}
+
+HevEventLoop *
+hev_event_loop_new_full (HevEventLoopBackend backend)
 {
 	HevEventLoop *self = HEV_MEMORY_ALLOCATOR_ALLOC (sizeof (HevEventLoop));
 
 	if (self) {
-		self->epoll_fd = epoll_create (1024);
+		update_time (self);
+		self->timer_wheel = hev_timer_wheel_new (self->time / TIMER_TICK_NS);
+		if (!self->timer_wheel) {
+			HEV_MEMORY_ALLOCATOR_FREE (self);
+			return NULL;
+		}
+		self->uring = NULL;
+		if (HEV_EVENT_LOOP_BACKEND_URING == backend)
+		  self->uring = hev_event_loop_uring_new ();
+		self->epoll_fd = self->uring ? -1 : epoll_create (1024);
 		self->ref_count = 1;
+		self->dispatch_budget = DISPATCH_BUDGET_DEFAULT;
+		self->busy_poll_max = 0;
+		self->busy_poll_gap = 0;
 		self->run = true;
+		self->defer_changes = false;
+		self->stats_enabled = false;
+		memset (&self->stats, 0, sizeof (self->stats));
+		self->timer_deadline_count = 0;
+		self->trace = NULL;
+		self->watchdog = NULL;
 		self->sources = NULL;
-		self->fd_list = NULL;
+		self->ready_mask = 0;
+		self->ready_count = 0;
+		memset (self->ready_lists, 0, sizeof (self->ready_lists));
+		self->sched_policy = HEV_EVENT_LOOP_SCHED_PRIORITY;
+		self->sched_tick = 0;
+		self->credit_mask = 0;
+		memset (self->credits, 0, sizeof (self->credits));
+		memset (self->served_at, 0, sizeof (self->served_at));
+		self->change_head = NULL;
+		self->change_tail = NULL;
+		self->idle_head = NULL;
+		self->idle_tail = NULL;
+		self->signal_mux = NULL;
+		self->batch_size = EVENT_BATCH_DEFAULT;
+		self->batch_min = EVENT_BATCH_DEFAULT;
+		self->batch_max = EVENT_BATCH_DEFAULT;
+		self->batch_low_waits = 0;
+		self->events = HEV_MEMORY_ALLOCATOR_ALLOC (sizeof (struct epoll_event) *
+					self->batch_size);
+		if (!self->events) {
+			hev_event_loop_unref (self);
+			return NULL;
+		}
+
+		/* owned by the sources list */
+		self->invoke_source = (HevEventSourceInvoke *) hev_event_source_invoke_new ();
+		if (!self->invoke_source) {
+			hev_event_loop_unref (self);
+			return NULL;
+		}
+		hev_event_loop_add_source (self, &self->invoke_source->parent);
+		hev_event_source_unref (&self->invoke_source->parent);
 	}
 
 	return self;
@@ -49,184 +261,1379 @@ hev_event_loop_ref (HevEventLoop *self)
 	return self;
 }
 
-static void
-fd_list_free_handler (void *data)
+void
+hev_event_loop_unref (HevEventLoop *self)
 {
-	HevEventSourceFD *fd = data;
-	_hev_event_source_fd_dispatch_finish (fd);
+	HevEventSource *source = NULL;
+
+	self->ref_count --;
+	if (0 < self->ref_count)
+	  return;
+
+	/* polls and I/O in flight reference fds and buffers, finish them, and
+	 * timers of sources held elsewhere must not outlive the wheel */
+	for (source=self->sources; source; source=source->_next) {
+		HevEventSourceFD *fd;
+		for (fd=source->fds; fd; fd=fd->_next)
+		  if (self->uring || (0 > fd->fd))
+		    _hev_event_loop_del_fd (self, fd);
+	}
+	if (self->uring)
+	  hev_event_loop_uring_free (self->uring);
+
+	/* the epoll fd goes away, pending changes are moot */
+	while (self->change_head) {
+		HevEventSourceFD *fd = self->change_head;
+		self->change_head = fd->_change_next;
+		fd->_change_next = NULL;
+		fd->_changed = 0;
+		_hev_event_source_fd_unref (fd);
+	}
+	self->change_tail = NULL;
+
+	while (self->idle_head) {
+		HevEventSourceFD *fd = self->idle_head;
+		self->idle_head = fd->_idle_next;
+		fd->_idle_next = NULL;
+		_hev_event_source_fd_unref (fd);
+	}
+	self->idle_tail = NULL;
+
+	ready_lists_clear (self);
+	while (self->sources) {
+		source = self->sources;
+		self->sources = source->_next;
+		source->_prev = NULL;
+		source->_next = NULL;
+		_hev_event_source_set_loop (source, NULL);
+		hev_event_source_unref (source);
+	}
+	hev_timer_wheel_unref (self->timer_wheel);
+	if (self->watchdog)
+	  hev_event_loop_watchdog_free (self->watchdog);
+	if (self->trace)
+	  hev_event_loop_trace_free (self->trace);
+	if (0 <= self->epoll_fd)
+	  close (self->epoll_fd);
+	if (self->events)
+	  HEV_MEMORY_ALLOCATOR_FREE (self->events);
+	HEV_MEMORY_ALLOCATOR_FREE (self);
 }
 
-static void
-sources_free_handler (void *data)
+static inline void
+ready_list_push (HevEventLoop *self, HevEventSourceFD *fd)
 {
-	HevEventSource *source = data;
-	_hev_event_source_set_loop (source, NULL);
-	hev_event_source_unref (source);
+	HevEventLoopReadyList *list;
+	int index = hev_event_source_get_priority (fd->source);
+
+	if (index < READY_PRIORITY_MIN)
+	  index = READY_PRIORITY_MIN;
+	else if (index > READY_PRIORITY_MAX)
+	  index = READY_PRIORITY_MAX;
+	index -= READY_PRIORITY_MIN;
+
+	list = &self->ready_lists[index];
+	fd->_ready_next = NULL;
+	fd->_dispatch_count = 0;
+	if (list->tail) {
+		list->tail->_ready_next = fd;
+	} else {
+		list->head = fd;
+		self->served_at[index] = self->sched_tick;
+	}
+	list->tail = fd;
+	self->ready_mask |= (UINT64_C (1) << index);
+	self->ready_count ++;
 }
 
-void
-hev_event_loop_unref (HevEventLoop *self)
+static inline void
+ready_fd (HevEventLoop *self, HevEventSourceFD *fd, uint32_t events)
 {
-	self->ref_count --;
-	if (0 < self->ref_count)
+	fd->revents |= events;
+	if (fd->_dispatched)
 	  return;
+	_hev_event_source_fd_dispatch (fd);
+	ready_list_push (self, fd);
+}
 
-	hev_slist_free_notify (self->fd_list, fd_list_free_handler);
-	hev_slist_free_notify (self->sources, sources_free_handler);
-	close (self->epoll_fd);
-	HEV_MEMORY_ALLOCATOR_FREE (self);
+static inline int
+ready_list_highest (HevEventLoop *self)
+{
+	return 63 - __builtin_clzll (self->ready_mask);
 }
 
-static HevSList *
-insert_event_source_fd_sorted (HevSList *fd_list, HevEventSourceFD *fd)
+static inline void
+ready_list_pop (HevEventLoop *self, int index)
 {
-	HevSList *list = NULL, *prev = NULL;
+	HevEventLoopReadyList *list = &self->ready_lists[index];
 
-	for (list=fd_list; list; prev=list,list=hev_slist_next (list)) {
-		HevEventSourceFD *_fd  = hev_slist_data (list);
-		if (hev_event_source_get_priority (fd->source) >
-				hev_event_source_get_priority (_fd->source))
-		  break;
+	list->head = list->head->_ready_next;
+	if (!list->head) {
+		list->tail = NULL;
+		self->ready_mask &= ~(UINT64_C (1) << index);
 	}
-	return hev_slist_insert_after (fd_list, fd, prev);
+	self->ready_count --;
 }
 
-static void
-invalid_sources_free_handler (void *data)
+/* the head used its source's budget, let the others of its list go first */
+static inline void
+ready_list_rotate (HevEventLoop *self, int index)
+{
+	HevEventLoopReadyList *list = &self->ready_lists[index];
+	HevEventSourceFD *fd = list->head;
+
+	fd->_dispatch_count = 0;
+	if (!fd->_ready_next)
+	  return;
+
+	list->head = fd->_ready_next;
+	fd->_ready_next = NULL;
+	list->tail->_ready_next = fd;
+	list->tail = fd;
+}
+
+static inline int
+sched_weighted (HevEventLoop *self)
 {
-	HevEventSource *source = data;
-	hev_event_loop_del_source (source->loop, source);
+	uint64_t mask = self->ready_mask & self->credit_mask;
+	int i;
+
+	/* every ready list spent its credits, start a new round */
+	if (!mask) {
+		for (i=0; i<READY_LIST_COUNT; i++)
+		  self->credits[i] = i + 1;
+		self->credit_mask = UINT64_MAX;
+		mask = self->ready_mask;
+	}
+
+	return 63 - __builtin_clzll (mask);
 }
 
 static inline int
-dispatch_events (HevEventLoop *self)
+sched_aging (HevEventLoop *self)
+{
+	uint64_t mask = self->ready_mask;
+	uint64_t best_score = 0;
+	int best = 0;
+
+	while (mask) {
+		int i = __builtin_ctzll (mask);
+		uint64_t score = (uint64_t) i * SCHED_AGING_STEP +
+			(self->sched_tick - self->served_at[i]);
+
+		if (score >= best_score) {
+			best_score = score;
+			best = i;
+		}
+		mask &= mask - 1;
+	}
+
+	return best;
+}
+
+static inline int
+sched_next (HevEventLoop *self)
+{
+	switch (self->sched_policy) {
+	case HEV_EVENT_LOOP_SCHED_WEIGHTED:
+		return sched_weighted (self);
+	case HEV_EVENT_LOOP_SCHED_AGING:
+		return sched_aging (self);
+	default:
+		return ready_list_highest (self);
+	}
+}
+
+static void
+ready_lists_clear (HevEventLoop *self)
+{
+	while (self->ready_mask) {
+		int index = ready_list_highest (self);
+		HevEventSourceFD *fd = self->ready_lists[index].head;
+		ready_list_pop (self, index);
+		_hev_event_source_fd_dispatch_finish (fd);
+	}
+}
+
+/* Log-linear: exact below 4, then 4 buckets per power of two. */
+static inline void
+histogram_add (HevEventLoopHistogram *hist, uint64_t value)
+{
+	unsigned int index = value;
+
+	if (4 <= value) {
+		unsigned int exp = 63 - __builtin_clzll (value);
+		index = (exp - 1) * 4 + ((value >> (exp - 2)) & 3);
+		if (HEV_EVENT_LOOP_HISTOGRAM_SIZE <= index)
+		  index = HEV_EVENT_LOOP_HISTOGRAM_SIZE - 1;
+	}
+	hist->buckets[index] ++;
+	hist->count ++;
+}
+
+static inline void
+stats_add_dispatch (HevEventLoop *self, HevEventSource *source, uint64_t begin)
+{
+	uint64_t time = get_time () - begin;
+
+	self->stats.dispatches ++;
+	histogram_add (&self->stats.dispatch_time, time);
+	/* NULL if the callback removed it */
+	if (source) {
+		source->stats.dispatches ++;
+		source->stats.total_ns += time;
+		if (source->stats.max_ns < time)
+		  source->stats.max_ns = time;
+	}
+}
+
+static inline void
+stats_add_wait (HevEventLoop *self, int nfds, uint64_t begin)
+{
+	HevEventLoopStats *stats = &self->stats;
+
+	stats->waits ++;
+	stats->blocked_ns += self->time - begin;
+	histogram_add (&stats->wait_time, self->time - begin);
+	if (0 < nfds) {
+		stats->events += nfds;
+		if (stats->max_events < nfds)
+		  stats->max_events = nfds;
+		if (!self->uring && (nfds >= self->batch_size))
+		  stats->full_batches ++;
+	}
+	stats->ready_fds += self->ready_count;
+	if (stats->max_ready_fds < self->ready_count)
+	  stats->max_ready_fds = self->ready_count;
+}
+
+/* Deadlines of the timers expired by this wakeup, each distinct one but
+ * one would have cost a wakeup of its own, counted after the expiry pass
+ * (up to TIMER_DEADLINES_TRACKED of them). */
+static inline void
+stats_add_timer (HevEventLoop *self, HevTimerWheelEntry *timer)
+{
+	unsigned int i;
+
+	self->stats.timers ++;
+	for (i=0; i<self->timer_deadline_count; i++)
+	  if (self->timer_deadlines[i] == timer->deadline)
+	    return;
+	if (TIMER_DEADLINES_TRACKED > i) {
+		self->timer_deadlines[i] = timer->deadline;
+		self->timer_deadline_count ++;
+	}
+}
+
+static inline void
+trace_begin (HevEventLoop *self, HevEventLoopTraceType type,
+			HevEventSource *source, int fd)
+{
+	if (self->trace)
+	  hev_event_loop_trace_record (self->trace, get_time (), type, true, source, fd);
+}
+
+static inline void
+trace_end (HevEventLoop *self, HevEventLoopTraceType type)
 {
-	HevSList *invalid_sources = NULL;
+	if (self->trace)
+	  hev_event_loop_trace_record (self->trace, get_time (), type, false, NULL, -1);
+}
+
+static inline void
+dispatch_event (HevEventLoop *self)
+{
+	HevEventSource *invalid_source = NULL;
 	HevEventSourceFD *fd;
 	HevEventSource *source;
+	int index;
 
-	if (!self->fd_list)
-	  return -1;
-
-	/* get highest priority source fd, check & dispatch */
-	fd = hev_slist_data (self->fd_list);
+	/* get the next source fd by the policy, check & dispatch */
+	index = sched_next (self);
+	fd = self->ready_lists[index].head;
 	source = fd->source;
-	if (source && (hev_event_source_get_loop (source) == self) &&
-				source->funcs.check (source, fd)) {
-		bool res = source->funcs.dispatch (source, fd,
-					source->callback.callback, source->callback.data);
-		/* recheck, in user's dispatch, source and fd may be remove. */
-		if (fd->source) {
-			if (res) {
-				if (hev_event_source_get_loop (source) == self)
-				  source->funcs.prepare (source);
-			} else {
-				fd->revents = 0;
-				invalid_sources = hev_slist_prepend (invalid_sources, source);
+	self->sched_tick ++;
+	self->served_at[index] = self->sched_tick;
+	if ((HEV_EVENT_LOOP_SCHED_WEIGHTED == self->sched_policy) &&
+				!(-- self->credits[index]))
+	  self->credit_mask &= ~(UINT64_C (1) << index);
+	if (self->watchdog)
+	  hev_event_loop_watchdog_beat (self->watchdog, fd);
+	if (source && (hev_event_source_get_loop (source) == self)) {
+		uint64_t begin = STATS_ENABLED (self) ? get_time () : 0;
+		bool checked;
+
+		trace_begin (self, HEV_EVENT_LOOP_TRACE_CHECK, source, fd->fd);
+		checked = source->funcs.check (source, fd);
+		trace_end (self, HEV_EVENT_LOOP_TRACE_CHECK);
+		if (checked) {
+			bool res;
+
+			trace_begin (self, HEV_EVENT_LOOP_TRACE_DISPATCH, source, fd->fd);
+			res = source->funcs.dispatch (source, fd,
+						source->callback.callback, source->callback.data);
+			trace_end (self, HEV_EVENT_LOOP_TRACE_DISPATCH);
+			if (STATS_ENABLED (self))
+			  stats_add_dispatch (self, fd->source, begin);
+			/* recheck, in user's dispatch, source and fd may be remove. */
+			if (fd->source) {
+				if (res) {
+					if (hev_event_source_get_loop (source) == self) {
+						trace_begin (self, HEV_EVENT_LOOP_TRACE_PREPARE, source, fd->fd);
+						source->funcs.prepare (source);
+						trace_end (self, HEV_EVENT_LOOP_TRACE_PREPARE);
+					}
+				} else {
+					fd->revents = 0;
+					invalid_source = source;
+				}
 			}
+		} else if (STATS_ENABLED (self)) {
+			source->stats.check_failures ++;
 		}
+	} else {
+		/* the source left the loop while the fd was ready */
+		fd->revents = 0;
 	}
 
 	if (!(fd->_events & fd->revents) || !fd->source) {
-		self->fd_list = hev_slist_remove (self->fd_list, fd);
+		ready_list_pop (self, index);
 		_hev_event_source_fd_dispatch_finish (fd);
+	} else if (fd->source->budget &&
+				(++ fd->_dispatch_count >= fd->source->budget)) {
+		ready_list_rotate (self, index);
 	}
 
-	/* delete invalid sources */
-	if (invalid_sources)
-	  hev_slist_free_notify (invalid_sources, invalid_sources_free_handler);
+	/* delete invalid source */
+	if (invalid_source)
+	  hev_event_loop_del_source (self, invalid_source);
+}
+
+static inline int
+dispatch_events (HevEventLoop *self)
+{
+	unsigned int count = 0;
+
+	/* drain the ready list, until empty or the budget is spent */
+	while (self->ready_mask && self->run) {
+		if (self->dispatch_budget && (count >= self->dispatch_budget))
+		  return 0;
+		dispatch_event (self);
+		count ++;
+	}
 
-	return 0;
+	return self->ready_mask ? 0 : -1;
 }
 
-void
-hev_event_loop_run (HevEventLoop *self)
+/* The ready lists are empty, queue the idle fds and dispatch them,
+ * returns the next timeout as dispatch_events. */
+static inline int
+dispatch_idle (HevEventLoop *self)
 {
-	int timeout = -1;
+	HevEventSourceFD *fd = self->idle_head;
 
-	while (self->run) {
-		int i = 0, nfds = 0;
-		struct epoll_event events[256];
-
-		/* waiting events */
-		nfds = epoll_wait (self->epoll_fd, events, 256, timeout);
-		if (-1 == nfds && EINTR != errno) {
-			fprintf (stderr, "EPoll wait failed!\n");
-			break;
-		}
+	if (!fd)
+	  return -1;
 
-		/* insert to fd_list, sorted by source priority (highest ... lowest) */
-		for (i=0; i<nfds; i++) {
-			HevEventSourceFD *fd = events[i].data.ptr;
-			fd->revents |= events[i].events;
-			if (fd->_dispatched)
-			  continue;
-			_hev_event_source_fd_dispatch (fd);
-			self->fd_list = insert_event_source_fd_sorted (self->fd_list, fd);
-		}
+	/* prepare queues the fds again for the next time */
+	self->idle_head = NULL;
+	self->idle_tail = NULL;
+	while (fd) {
+		HevEventSourceFD *next = fd->_idle_next;
+		fd->_idle_next = NULL;
+		ready_fd (self, fd, EPOLLIN);
+		_hev_event_source_fd_unref (fd);
+		fd = next;
+	}
+	dispatch_events (self);
 
-		/* dispatch */
-		timeout = dispatch_events (self);
+	return (self->ready_mask || self->idle_head) ? 0 : -1;
+}
+
+static void
+timer_expire_handler (HevTimerWheelEntry *timer, void *data)
+{
+	HevEventLoop *self = data;
+
+	ready_fd (self, timer->data, EPOLLIN);
+	if (STATS_ENABLED (self))
+	  stats_add_timer (self, timer);
+}
+
+static void
+uring_ready_handler (HevEventSourceFD *fd, uint32_t events, void *data)
+{
+	ready_fd (data, fd, events);
+}
+
+/* ns to the next timer, -1 if none */
+static inline int64_t
+get_timeout (HevEventLoop *self)
+{
+	int64_t ticks;
+	uint64_t next;
+
+	/* from now, not from before the callbacks just dispatched */
+	update_time (self);
+	ticks = hev_timer_wheel_get_timeout (self->timer_wheel,
+				self->time / TIMER_TICK_NS);
+	if (0 > ticks)
+	  return -1;
+
+	next = (self->time / TIMER_TICK_NS + ticks) * TIMER_TICK_NS;
+	return (next > self->time) ? (int64_t) (next - self->time) : 0;
+}
+
+static int
+epoll_wait_ns (int epfd, struct epoll_event *events, int count, int64_t timeout)
+{
+	static bool pwait2_missing;
+	struct timespec ts;
+	int64_t ms;
+
+	/* whole ms, or a kernel without epoll_pwait2 (5.11) */
+	if ((0 < timeout) && (timeout % 1000000) && !pwait2_missing) {
+		int res;
+
+		ts.tv_sec = timeout / 1000000000;
+		ts.tv_nsec = timeout % 1000000000;
+		res = syscall (__NR_epoll_pwait2, epfd, events, count, &ts, NULL, 0);
+		if ((0 <= res) || (ENOSYS != errno))
+		  return res;
+		pwait2_missing = true;
 	}
+
+	if (0 > timeout)
+	  return epoll_wait (epfd, events, count, -1);
+	ms = (timeout + 999999) / 1000000;
+	return epoll_wait (epfd, events, count, (INT_MAX < ms) ? INT_MAX : ms);
 }
 
-void
-hev_event_loop_quit (HevEventLoop *self)
+static inline int
+wait_events (HevEventLoop *self, struct epoll_event *events, int count, int64_t timeout)
 {
-	self->run = false;
+	if (self->uring)
+	  return hev_event_loop_uring_wait (self->uring, timeout);
+
+	return epoll_wait_ns (self->epoll_fd, events, count, timeout);
 }
 
-bool
-hev_event_loop_add_source (HevEventLoop *self, HevEventSource *source)
+/* Polls without blocking for about twice the average time events took
+ * to come lately, not at all if that is beyond busy_poll_max, when a
+ * blocking wait is cheaper than the spin. */
+static int
+busy_poll (HevEventLoop *self, struct epoll_event *events, int count,
+			int64_t timeout, uint64_t start)
 {
-	HevSList *list = NULL;
+	uint64_t spin = self->busy_poll_gap * 2;
+	int nfds = 0;
 
-	if (source->loop == self)
-	  return false;
+	if (self->busy_poll_gap > self->busy_poll_max)
+	  return 0;
+	if (spin > self->busy_poll_max)
+	  spin = self->busy_poll_max;
+	if ((0 < timeout) && (spin > (uint64_t) timeout))
+	  spin = timeout;
 
-	_hev_event_source_set_loop (source, self);
-	self->sources = hev_slist_prepend (self->sources, hev_event_source_ref (source));
-	for (list=source->fds; list; list=hev_slist_next (list)) {
-		HevEventSourceFD *fd = hev_slist_data (list);
-		_hev_event_loop_add_fd (self, fd);
+	while (spin) {
+		nfds = wait_events (self, events, count, 0);
+		if (nfds || !self->run || ((get_time () - start) >= spin))
+		  break;
 	}
-	source->funcs.prepare (source);
 
-	return true;
+	return nfds;
 }
 
-bool
-hev_event_loop_del_source (HevEventLoop *self, HevEventSource *source)
+static bool
+batch_resize (HevEventLoop *self, unsigned int size)
 {
-	HevSList *list = NULL;
+	struct epoll_event *events;
 
-	if (source->loop != self)
+	events = HEV_MEMORY_ALLOCATOR_ALLOC (sizeof (struct epoll_event) * size);
+	if (!events)
 	  return false;
 
-	_hev_event_source_set_loop (source, NULL);
-	self->sources = hev_slist_remove (self->sources, source);
-	for (list=source->fds; list; list=hev_slist_next (list)) {
-		HevEventSourceFD *fd = hev_slist_data (list);
-		_hev_event_loop_del_fd (self, fd);
+	HEV_MEMORY_ALLOCATOR_FREE (self->events);
+	self->events = events;
+	self->batch_size = size;
+	self->batch_low_waits = 0;
+
+	return true;
+}
+
+/* Doubles the batch when a wait fills it, more events are likely
+ * waiting, halves it when sustained low counts leave it mostly unused. */
+static inline void
+batch_adapt (HevEventLoop *self, int nfds)
+{
+	unsigned int size = self->batch_size;
+
+	if (nfds >= (int) size) {
+		if (size < self->batch_max)
+		  batch_resize (self, (size * 2 < self->batch_max) ? size * 2 : self->batch_max);
+		self->batch_low_waits = 0;
+	} else if ((nfds < (int) (size / 4)) && (size > self->batch_min)) {
+		if (++ self->batch_low_waits >= EVENT_BATCH_SHRINK_WAITS)
+		  batch_resize (self, (size / 2 > self->batch_min) ? size / 2 : self->batch_min);
+	} else {
+		self->batch_low_waits = 0;
 	}
-	hev_event_source_unref (source);
+}
+
+/* Waits up to timeout ns, then queues what is ready, false on failure. */
+static bool
+poll_events (HevEventLoop *self, int64_t timeout)
+{
+	int i = 0, nfds = 0;
+	uint64_t idle = 0, begin = 0;
+	struct epoll_event *events = self->events;
+	int count = self->batch_size;
+
+	flush_changes (self);
+	if (STATS_ENABLED (self) || (timeout && self->busy_poll_max))
+	  begin = get_time ();
+	if (self->watchdog)
+	  hev_event_loop_watchdog_beat (self->watchdog, NULL);
+	trace_begin (self, HEV_EVENT_LOOP_TRACE_WAIT, NULL, -1);
+	if (timeout && self->busy_poll_max) {
+		idle = begin;
+		nfds = busy_poll (self, events, count, timeout, idle);
+		/* the spin is taken from the time left to the next timer */
+		if (!nfds && (0 < timeout)) {
+			uint64_t spun = get_time () - idle;
+			timeout = (spun < (uint64_t) timeout) ? timeout - spun : 0;
+		}
+	}
+	if (!nfds)
+	  nfds = wait_events (self, events, count, timeout);
+	trace_end (self, HEV_EVENT_LOOP_TRACE_WAIT);
+	if (-1 == nfds && EINTR != errno) {
+		fprintf (stderr, "EPoll wait failed!\n");
+		return false;
+	}
+
+	/* expire timers, then queue to ready lists, by source priority */
+	update_time (self);
+	if (idle && (0 < nfds)) {
+		int64_t gap = self->time - idle;
+		self->busy_poll_gap += (gap - (int64_t) self->busy_poll_gap) / 8;
+	}
+	self->timer_deadline_count = 0;
+	hev_timer_wheel_advance (self->timer_wheel, self->time / TIMER_TICK_NS,
+				timer_expire_handler, self);
+	if (self->timer_deadline_count > 1)
+	  self->stats.timer_wakeups_saved += self->timer_deadline_count - 1;
+	if (self->uring)
+	  hev_event_loop_uring_reap (self->uring, uring_ready_handler, self);
+	else
+	  for (i=0; i<nfds; i++)
+	    ready_fd (self, events[i].data.ptr, events[i].events);
+	if (STATS_ENABLED (self))
+	  stats_add_wait (self, nfds, begin);
+	if (!self->uring && (self->batch_min < self->batch_max))
+	  batch_adapt (self, nfds);
 
 	return true;
 }
 
-bool
-_hev_event_loop_add_fd (HevEventLoop *self, HevEventSourceFD *fd)
+void
+hev_event_loop_run (HevEventLoop *self)
 {
-	struct epoll_event event;
+	int64_t timeout = -1;
 
-	event.events = fd->_events | EPOLLET;
-	event.data.ptr = fd;
-	return (0 == epoll_ctl (self->epoll_fd, EPOLL_CTL_ADD, fd->fd, &event));
+	while (self->run) {
+		/* waiting events, until the next timer at most, not at all while
+		 * fds are ready or idle sources queued, e.g. by add_source */
+		if (timeout)
+		  timeout = (self->ready_mask || self->idle_head) ? 0 : get_timeout (self);
+		if (!poll_events (self, timeout))
+		  break;
+
+		/* dispatch, then idle sources if nothing else is ready */
+		timeout = dispatch_events (self);
+		if (timeout)
+		  timeout = dispatch_idle (self);
+	}
+
+	/* the caller's code runs next, not a source */
+	if (self->watchdog)
+	  hev_event_loop_watchdog_beat (self->watchdog, NULL);
 }
 
 bool
-_hev_event_loop_del_fd (HevEventLoop *self, HevEventSourceFD *fd)
+hev_event_loop_iterate (HevEventLoop *self, bool may_block)
 {
-	return (0 == epoll_ctl (self->epoll_fd, EPOLL_CTL_DEL, fd->fd, NULL));
+	int64_t timeout = 0;
+
+	self->run = true;
+	if (may_block && !self->ready_mask && !self->idle_head)
+	  timeout = get_timeout (self);
+	if (poll_events (self, timeout) && dispatch_events (self))
+	  dispatch_idle (self);
+
+	/* the outer loop polls our fd next, it has to be up to date */
+	flush_changes (self);
+	if (self->uring)
+	  hev_event_loop_uring_wait (self->uring, 0);
+	if (self->watchdog)
+	  hev_event_loop_watchdog_beat (self->watchdog, NULL);
+
+	return self->ready_mask || self->idle_head;
+}
+
+int
+hev_event_loop_get_fd (HevEventLoop *self)
+{
+	if (self->uring)
+	  return hev_event_loop_uring_get_fd (self->uring);
+
+	return self->epoll_fd;
+}
+
+int
+hev_event_loop_get_timeout (HevEventLoop *self)
+{
+	int64_t timeout;
+
+	if (self->ready_mask || self->idle_head)
+	  return 0;
+
+	timeout = get_timeout (self);
+	if (0 > timeout)
+	  return -1;
+	timeout = (timeout + 999999) / 1000000;
+	return (INT_MAX < timeout) ? INT_MAX : timeout;
+}
+
+void
+hev_event_loop_quit (HevEventLoop *self)
+{
+	self->run = false;
+}
+
+void
+hev_event_loop_set_dispatch_budget (HevEventLoop *self, unsigned int budget)
+{
+	self->dispatch_budget = budget;
+}
+
+unsigned int
+hev_event_loop_get_dispatch_budget (HevEventLoop *self)
+{
+	return self->dispatch_budget;
+}
+
+void
+hev_event_loop_set_stats (HevEventLoop *self, bool enable)
+{
+	self->stats_enabled = enable;
+}
+
+const HevEventLoopStats *
+hev_event_loop_get_stats (HevEventLoop *self)
+{
+	return HEV_EVENT_LOOP_STATS ? &self->stats : NULL;
+}
+
+void
+hev_event_loop_reset_stats (HevEventLoop *self)
+{
+	HevEventSource *source;
+
+	memset (&self->stats, 0, sizeof (self->stats));
+	for (source=self->sources; source; source=source->_next)
+	  memset (&source->stats, 0, sizeof (source->stats));
+}
+
+uint64_t
+hev_event_loop_histogram_percentile (const HevEventLoopHistogram *hist,
+			double percentile)
+{
+	uint64_t rank, count = 0;
+	unsigned int i;
+
+	if (!hist->count)
+	  return 0;
+
+	rank = hist->count * percentile / 100;
+	if (rank >= hist->count)
+	  rank = hist->count - 1;
+	for (i=0; i<HEV_EVENT_LOOP_HISTOGRAM_SIZE; i++) {
+		count += hist->buckets[i];
+		if (count > rank)
+		  break;
+	}
+
+	/* the upper bound of the bucket */
+	if (4 > i)
+	  return i;
+	return ((UINT64_C (5) + (i & 3)) << (i / 4 - 1)) - 1;
+}
+
+void
+hev_event_loop_dump_stats (HevEventLoop *self, int fd)
+{
+	HevEventLoopStats *stats = &self->stats;
+	HevEventSource *source;
+	uint64_t waits = stats->waits ? stats->waits : 1;
+
+	dprintf (fd, "loop %p: %llu waits, %.1f events/wait (max %llu), %llu ms blocked, "
+				"%.1f ready fds/wait (max %llu), %llu dispatches\n", self,
+				(unsigned long long) stats->waits, (double) stats->events / waits,
+				(unsigned long long) stats->max_events,
+				(unsigned long long) stats->blocked_ns / 1000000,
+				(double) stats->ready_fds / waits,
+				(unsigned long long) stats->max_ready_fds,
+				(unsigned long long) stats->dispatches);
+	dprintf (fd, "  event batch %u, %llu waits filled it\n", self->batch_size,
+				(unsigned long long) stats->full_batches);
+	dprintf (fd, "  %llu timers, %llu wakeups saved by slack\n",
+				(unsigned long long) stats->timers,
+				(unsigned long long) stats->timer_wakeups_saved);
+	dprintf (fd, "  wait ns: p50 %llu p99 %llu p99.9 %llu\n",
+				(unsigned long long) hev_event_loop_histogram_percentile (&stats->wait_time, 50),
+				(unsigned long long) hev_event_loop_histogram_percentile (&stats->wait_time, 99),
+				(unsigned long long) hev_event_loop_histogram_percentile (&stats->wait_time, 99.9));
+	dprintf (fd, "  dispatch ns: p50 %llu p99 %llu p99.9 %llu\n",
+				(unsigned long long) hev_event_loop_histogram_percentile (&stats->dispatch_time, 50),
+				(unsigned long long) hev_event_loop_histogram_percentile (&stats->dispatch_time, 99),
+				(unsigned long long) hev_event_loop_histogram_percentile (&stats->dispatch_time, 99.9));
+	for (source=self->sources; source; source=source->_next) {
+		HevEventSourceStats *sstats = &source->stats;
+		const char *name = hev_event_source_get_name (source);
+
+		if (!sstats->dispatches && !sstats->check_failures)
+		  continue;
+		dprintf (fd, "  source %s (%p) priority %d: %llu dispatches, %llu check failures, "
+					"%llu ns avg, %llu ns max\n", name ? name : "-", source, source->priority,
+					(unsigned long long) sstats->dispatches,
+					(unsigned long long) sstats->check_failures,
+					(unsigned long long) (sstats->dispatches ?
+						sstats->total_ns / sstats->dispatches : 0),
+					(unsigned long long) sstats->max_ns);
+	}
+}
+
+bool
+hev_event_loop_set_event_batch (HevEventLoop *self, unsigned int size,
+			unsigned int max_size)
+{
+	if (!size)
+	  return false;
+	if (max_size < size)
+	  max_size = size;
+
+	if ((size != self->batch_size) && !batch_resize (self, size))
+	  return false;
+	self->batch_min = size;
+	self->batch_max = max_size;
+
+	return true;
+}
+
+unsigned int
+hev_event_loop_get_event_batch (HevEventLoop *self)
+{
+	return self->batch_size;
+}
+
+bool
+hev_event_loop_set_trace (HevEventLoop *self, unsigned int size)
+{
+	HevEventLoopTrace *trace = NULL;
+
+	if (size) {
+		trace = hev_event_loop_trace_new (size);
+		if (!trace)
+		  return false;
+	}
+	if (self->trace)
+	  hev_event_loop_trace_free (self->trace);
+	self->trace = trace;
+
+	return true;
+}
+
+bool
+hev_event_loop_dump_trace (HevEventLoop *self, int fd)
+{
+	if (!self->trace)
+	  return false;
+
+	return hev_event_loop_trace_dump (self->trace, fd);
+}
+
+bool
+hev_event_loop_set_watchdog (HevEventLoop *self, unsigned int threshold_ms, int fd)
+{
+	HevEventLoopWatchdog *watchdog = NULL;
+
+	if (threshold_ms) {
+		watchdog = hev_event_loop_watchdog_new (threshold_ms, fd);
+		if (!watchdog)
+		  return false;
+	}
+	if (self->watchdog)
+	  hev_event_loop_watchdog_free (self->watchdog);
+	self->watchdog = watchdog;
+
+	return true;
+}
+
+void
+hev_event_loop_set_sched_policy (HevEventLoop *self, HevEventLoopSchedPolicy policy)
+{
+	self->sched_policy = policy;
+	self->credit_mask = 0;
+}
+
+HevEventLoopSchedPolicy
+hev_event_loop_get_sched_policy (HevEventLoop *self)
+{
+	return self->sched_policy;
+}
+
+void
+hev_event_loop_set_busy_poll (HevEventLoop *self, unsigned int max_us)
+{
+	self->busy_poll_max = (uint64_t) max_us * 1000;
+	self->busy_poll_gap = 0;
+}
+
+unsigned int
+hev_event_loop_get_busy_poll (HevEventLoop *self)
+{
+	return self->busy_poll_max / 1000;
+}
+
+bool
+hev_event_loop_set_kernel_busy_poll (HevEventLoop *self, unsigned int usecs,
+			unsigned int budget, bool prefer)
+{
+	struct epoll_params params;
+
+	if (self->uring)
+	  return false;
+
+	memset (&params, 0, sizeof (params));
+	params.busy_poll_usecs = usecs;
+	params.busy_poll_budget = budget;
+	params.prefer_busy_poll = prefer;
+	return (0 == ioctl (self->epoll_fd, EPIOCSPARAMS, &params));
+}
+
+void
+hev_event_loop_set_defer_changes (HevEventLoop *self, bool defer)
+{
+	/* io_uring batches its submissions anyway */
+	if (self->uring)
+	  return;
+
+	self->defer_changes = defer;
+	if (!defer)
+	  flush_changes (self);
+}
+
+bool
+hev_event_loop_get_defer_changes (HevEventLoop *self)
+{
+	return self->defer_changes;
+}
+
+bool
+hev_event_loop_flush_changes (HevEventLoop *self)
+{
+	return flush_changes (self);
+}
+
+HevEventLoopBackend
+hev_event_loop_get_backend (HevEventLoop *self)
+{
+	return self->uring ? HEV_EVENT_LOOP_BACKEND_URING : HEV_EVENT_LOOP_BACKEND_EPOLL;
+}
+
+bool
+hev_event_loop_submit_read (HevEventLoop *self, int fd, void *buf, size_t len,
+			HevEventLoopIOFunc func, void *data)
+{
+	if (!self->uring)
+	  return false;
+
+	return hev_event_loop_uring_read (self->uring, fd, buf, len, func, data);
+}
+
+bool
+hev_event_loop_submit_write (HevEventLoop *self, int fd, const void *buf, size_t len,
+			HevEventLoopIOFunc func, void *data)
+{
+	if (!self->uring)
+	  return false;
+
+	return hev_event_loop_uring_write (self->uring, fd, buf, len, func, data);
+}
+
+bool
+hev_event_loop_submit_accept (HevEventLoop *self, int fd, struct sockaddr *addr,
+			socklen_t *addr_len, HevEventLoopIOFunc func, void *data)
+{
+	if (!self->uring)
+	  return false;
+
+	return hev_event_loop_uring_accept (self->uring, fd, addr, addr_len, func, data);
+}
+
+uint64_t
+hev_event_loop_now_ns (HevEventLoop *self)
+{
+	return self->time;
+}
+
+uint64_t
+hev_event_loop_now_ms (HevEventLoop *self)
+{
+	return self->time / 1000000;
+}
+
+void
+hev_event_loop_update_time (HevEventLoop *self)
+{
+	update_time (self);
+}
+
+bool
+hev_event_loop_add_source (HevEventLoop *self, HevEventSource *source)
+{
+	HevEventSourceFD *fd = NULL;
+
+	if (source->loop)
+	  return false;
+
+	/* relative deadlines set by prepare count from now, the loop may not
+	 * have run for a while */
+	update_time (self);
+	_hev_event_source_set_loop (source, self);
+	source->_prev = NULL;
+	source->_next = self->sources;
+	if (self->sources)
+	  self->sources->_prev = source;
+	self->sources = hev_event_source_ref (source);
+	for (fd=source->fds; fd; fd=fd->_next)
+	  _hev_event_loop_add_fd (self, fd);
+	source->funcs.prepare (source);
+
+	return true;
+}
+
+bool
+hev_event_loop_del_source (HevEventLoop *self, HevEventSource *source)
+{
+	HevEventSourceFD *fd = NULL;
+
+	if (source->loop != self)
+	  return false;
+
+	_hev_event_source_set_loop (source, NULL);
+	if (source->_prev)
+	  source->_prev->_next = source->_next;
+	else
+	  self->sources = source->_next;
+	if (source->_next)
+	  source->_next->_prev = source->_prev;
+	source->_prev = NULL;
+	source->_next = NULL;
+	for (fd=source->fds; fd; fd=fd->_next)
+	  _hev_event_loop_del_fd (self, fd);
+	hev_event_source_unref (source);
+
+	return true;
+}
+
+static inline uint32_t
+epoll_events (HevEventSourceFD *fd)
+{
+	uint32_t events = fd->_events & ~(EPOLLET | EPOLLONESHOT);
+
+	switch (fd->_trigger) {
+	case HEV_EVENT_SOURCE_FD_TRIGGER_LEVEL:
+		return events;
+	case HEV_EVENT_SOURCE_FD_TRIGGER_ONESHOT:
+		return events | EPOLLONESHOT;
+	default:
+		return events | EPOLLET;
+	}
+}
+
+static bool
+ctl_add (HevEventLoop *self, HevEventSourceFD *fd)
+{
+	struct epoll_event event;
+
+	if (self->uring)
+	  return hev_event_loop_uring_add_fd (self->uring, fd);
+
+	event.events = epoll_events (fd);
+	event.data.ptr = fd;
+	if (0 > epoll_ctl (self->epoll_fd, EPOLL_CTL_ADD, fd->fd, &event))
+	  return false;
+	fd->_armed = 1;
+
+	return true;
+}
+
+static bool
+ctl_mod (HevEventLoop *self, HevEventSourceFD *fd)
+{
+	struct epoll_event event;
+
+	if (self->uring)
+	  return hev_event_loop_uring_mod_fd (self->uring, fd);
+
+	if (!(fd->_events & EPOLLEXCLUSIVE)) {
+		event.events = epoll_events (fd);
+		event.data.ptr = fd;
+		if (0 == epoll_ctl (self->epoll_fd, EPOLL_CTL_MOD, fd->fd, &event))
+		  return true;
+		/* added with EPOLLEXCLUSIVE, being cleared now */
+		if (EINVAL != errno)
+		  return false;
+	}
+
+	/* exclusive wakeups can't be modified (EINVAL), only added again,
+	 * what is ready by then is reported by the add */
+	epoll_ctl (self->epoll_fd, EPOLL_CTL_DEL, fd->fd, NULL);
+	fd->_armed = 0;
+	return ctl_add (self, fd);
+}
+
+static bool
+ctl_del (HevEventLoop *self, HevEventSourceFD *fd)
+{
+	if (self->uring)
+	  return hev_event_loop_uring_del_fd (self->uring, fd);
+
+	fd->_armed = 0;
+	return (0 == epoll_ctl (self->epoll_fd, EPOLL_CTL_DEL, fd->fd, NULL));
+}
+
+static inline void
+change_list_push (HevEventLoop *self, HevEventSourceFD *fd, uint32_t change)
+{
+	uint32_t changed = fd->_changed;
+
+	fd->_changed |= CHANGE_QUEUED | change;
+	if (changed)
+	  return;
+
+	fd->_change_next = NULL;
+	if (self->change_tail)
+	  self->change_tail->_change_next = fd;
+	else
+	  self->change_head = fd;
+	self->change_tail = fd;
+	_hev_event_source_fd_ref (fd);
+}
+
+/* Only the net change of each fd is applied, in the order the fds were
+ * first changed, so a closed fd number is deleted before it is reused. */
+static bool
+flush_changes (HevEventLoop *self)
+{
+	bool res = true;
+
+	while (self->change_head) {
+		HevEventSourceFD *fd = self->change_head;
+		uint32_t changed = fd->_changed;
+
+		self->change_head = fd->_change_next;
+		fd->_change_next = NULL;
+		fd->_changed = 0;
+		if (fd->_registered && !fd->_armed) {
+			if (!ctl_add (self, fd)) {
+				fd->_registered = 0;
+				res = false;
+			}
+		} else if (!fd->_registered && fd->_armed) {
+			if (!ctl_del (self, fd))
+			  res = false;
+		} else if (fd->_registered && (CHANGE_EVENTS & changed)) {
+			if (!ctl_mod (self, fd))
+			  res = false;
+		}
+		_hev_event_source_fd_unref (fd);
+	}
+	self->change_tail = NULL;
+
+	return res;
+}
+
+bool
+_hev_event_loop_add_fd (HevEventLoop *self, HevEventSourceFD *fd)
+{
+	/* not backed by a kernel fd, made ready by the loop itself */
+	if (0 > fd->fd)
+	  return true;
+
+	/* like epoll's EEXIST, io_uring would only fail it on completion */
+	if (fd->_registered)
+	  return false;
+
+	fd->_registered = 1;
+	if (self->defer_changes) {
+		change_list_push (self, fd, 0);
+		return true;
+	}
+	if (ctl_add (self, fd))
+	  return true;
+	fd->_registered = 0;
+
+	return false;
+}
+
+bool
+_hev_event_loop_del_fd (HevEventLoop *self, HevEventSourceFD *fd)
+{
+	/* nothing may make it ready any more */
+	if (0 > fd->fd) {
+		if (fd->_timer)
+		  hev_timer_wheel_del (self->timer_wheel, fd->_timer);
+		if (fd->_idle_next || (self->idle_tail == fd))
+		  idle_list_remove (self, fd);
+		return true;
+	}
+
+	if (!fd->_registered)
+	  return false;
+
+	fd->_registered = 0;
+	if (self->defer_changes) {
+		change_list_push (self, fd, 0);
+		return true;
+	}
+
+	return ctl_del (self, fd);
+}
+
+bool
+_hev_event_loop_mod_fd (HevEventLoop *self, HevEventSourceFD *fd)
+{
+	if (0 > fd->fd)
+	  return true;
+
+	if (!fd->_registered)
+	  return false;
+
+	/* any number of changes collapse into one EPOLL_CTL_MOD */
+	if (self->defer_changes) {
+		change_list_push (self, fd, CHANGE_EVENTS);
+		return true;
+	}
+
+	return ctl_mod (self, fd);
+}
+
+static void
+idle_list_remove (HevEventLoop *self, HevEventSourceFD *fd)
+{
+	HevEventSourceFD *prev = NULL, *iter = self->idle_head;
+
+	while (iter && (iter != fd)) {
+		prev = iter;
+		iter = iter->_idle_next;
+	}
+	if (!iter)
+	  return;
+
+	if (prev)
+	  prev->_idle_next = fd->_idle_next;
+	else
+	  self->idle_head = fd->_idle_next;
+	if (self->idle_tail == fd)
+	  self->idle_tail = prev;
+	fd->_idle_next = NULL;
+	_hev_event_source_fd_unref (fd);
+}
+
+void
+_hev_event_loop_add_idle (HevEventLoop *self, HevEventSourceFD *fd)
+{
+	/* queued already */
+	if (fd->_idle_next || (self->idle_tail == fd))
+	  return;
+
+	if (self->idle_tail)
+	  self->idle_tail->_idle_next = fd;
+	else
+	  self->idle_head = fd;
+	self->idle_tail = fd;
+	_hev_event_source_fd_ref (fd);
+}
+
+void
+_hev_event_loop_ready_fd (HevEventLoop *self, HevEventSourceFD *fd, uint32_t events)
+{
+	ready_fd (self, fd, events);
+}
+
+HevEventSource *
+_hev_event_loop_get_signal_mux (HevEventLoop *self)
+{
+	/* owned by the sources list, as the invoke source */
+	if (!self->signal_mux) {
+		self->signal_mux = _hev_event_source_signal_mux_new ();
+		if (!self->signal_mux)
+		  return NULL;
+		hev_event_loop_add_source (self, self->signal_mux);
+		hev_event_source_unref (self->signal_mux);
+	}
+
+	return self->signal_mux;
+}
+
+void
+_hev_event_loop_add_timer (HevEventLoop *self, HevTimerWheelEntry *timer,
+			uint64_t expires, uint64_t slack)
+{
+	/* round up, a timer never expires early */
+	uint64_t deadline = (expires + TIMER_TICK_NS - 1) / TIMER_TICK_NS;
+	uint64_t ticks = slack / TIMER_TICK_NS;
+	uint64_t tick = deadline;
+
+	/* then up to a multiple of the largest power of two within the slack,
+	 * timers with overlapping windows mostly meet on the same tick */
+	if (ticks) {
+		uint64_t align = UINT64_C (1) << (63 - __builtin_clzll (ticks));
+		tick = (deadline + align - 1) & ~(align - 1);
+	}
+	timer->deadline = deadline;
+	((HevEventSourceFD *) timer->data)->_timer = timer;
+	hev_timer_wheel_add (self->timer_wheel, timer, tick);
+}
+
+void
+_hev_event_loop_del_timer (HevEventLoop *self, HevTimerWheelEntry *timer)
+{
+	hev_timer_wheel_del (self->timer_wheel, timer);
+}
+
+bool
+hev_event_loop_invoke (HevEventLoop *self, HevEventLoopInvokeFunc func, void *data)
+{
+	HevEventSourceInvoke *source = self->invoke_source;
+	HevEventLoopInvoke *invoke, *head;
+
+	/* freed by the loop thread, the allocators are not thread safe */
+	invoke = malloc (sizeof (HevEventLoopInvoke));
+	if (!invoke)
+	  return false;
+
+	invoke->func = func;
+	invoke->data = data;
+	head = __atomic_load_n (&source->queue, __ATOMIC_RELAXED);
+	do {
+		invoke->next = head;
+	} while (!__atomic_compare_exchange_n (&source->queue, &head, invoke, true,
+					__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	/* only the push to an empty queue wakes up the loop */
+	if (!head)
+	  eventfd_write (source->event_fd, 1);
+
+	return true;
+}
+
+static bool hev_event_source_invoke_check (HevEventSource *source, HevEventSourceFD *fd);
+static bool hev_event_source_invoke_dispatch (HevEventSource *source, HevEventSourceFD *fd,
+			HevEventSourceFunc callback, void *data);
+static void hev_event_source_invoke_finalize (HevEventSource *source);
+
+static HevEventSourceFuncs hev_event_source_invoke_funcs =
+{
+	.prepare = NULL,
+	.check = hev_event_source_invoke_check,
+	.dispatch = hev_event_source_invoke_dispatch,
+	.finalize = hev_event_source_invoke_finalize,
+};
+
+static HevEventSource *
+hev_event_source_invoke_new (void)
+{
+	int fd = -1;
+	HevEventSource *source = NULL;
+	HevEventSourceInvoke *self = NULL;
+
+	fd = eventfd (0, EFD_NONBLOCK);
+	if (-1 == fd)
+	  return NULL;
+
+	source = hev_event_source_new (&hev_event_source_invoke_funcs,
+				sizeof (HevEventSourceInvoke));
+	if (NULL == source) {
+		close (fd);
+		return NULL;
+	}
+
+	self = (HevEventSourceInvoke *) source;
+	self->event_fd = fd;
+	self->queue = NULL;
+	hev_event_source_add_fd (source, self->event_fd, EPOLLIN | EPOLLET);
+
+	return source;
+}
+
+static bool
+hev_event_source_invoke_check (HevEventSource *source, HevEventSourceFD *fd)
+{
+	HevEventSourceInvoke *self = (HevEventSourceInvoke *) source;
+
+	if (EPOLLIN & fd->revents) {
+		eventfd_t val = 0;
+		/* reset before taking the queue, a later push wakes us again */
+		eventfd_read (self->event_fd, &val);
+		fd->revents &= ~EPOLLIN;
+		return true;
+	}
+
+	return false;
+}
+
+static bool
+hev_event_source_invoke_dispatch (HevEventSource *source, HevEventSourceFD *fd,
+			HevEventSourceFunc callback, void *data)
+{
+	HevEventSourceInvoke *self = (HevEventSourceInvoke *) source;
+	HevEventLoopInvoke *invoke, *batch = NULL;
+
+	/* take the whole batch, it was pushed newest first */
+	invoke = __atomic_exchange_n (&self->queue, NULL, __ATOMIC_ACQUIRE);
+	while (invoke) {
+		HevEventLoopInvoke *next = invoke->next;
+		invoke->next = batch;
+		batch = invoke;
+		invoke = next;
+	}
+
+	while (batch) {
+		invoke = batch;
+		batch = invoke->next;
+		invoke->func (invoke->data);
+		free (invoke);
+	}
+
+	return true;
+}
+
+static void
+hev_event_source_invoke_finalize (HevEventSource *source)
+{
+	HevEventSourceInvoke *self = (HevEventSourceInvoke *) source;
+	HevEventLoopInvoke *invoke = self->queue;
+
+	/* invokes still queued when the loop goes away are dropped */
+	while (invoke) {
+		HevEventLoopInvoke *next = invoke->next;
+		free (invoke);
+		invoke = next;
+	}
+	close (self->event_fd);
 }
 
@@ -11,10 +11,72 @@
 #define __HEV_EVENT_LOOP_H__
 
 typedef struct _HevEventLoop HevEventLoop;
+typedef enum _HevEventLoopBackend HevEventLoopBackend;
+typedef enum _HevEventLoopSchedPolicy HevEventLoopSchedPolicy;
+typedef struct _HevEventLoopStats HevEventLoopStats;
+typedef struct _HevEventLoopHistogram HevEventLoopHistogram;
+typedef void (*HevEventLoopInvokeFunc) (void *data);
+typedef void (*HevEventLoopIOFunc) (int res, void *data);
+
+enum _HevEventLoopBackend
+{
+	HEV_EVENT_LOOP_BACKEND_EPOLL,
+	HEV_EVENT_LOOP_BACKEND_URING,
+};
+
+/* How the next ready fd is picked among the source priorities. */
+enum _HevEventLoopSchedPolicy
+{
+	/* always the highest priority, the default */
+	HEV_EVENT_LOOP_SCHED_PRIORITY,
+	/* round robin over priorities, priority p gets p + 33 turns a round */
+	HEV_EVENT_LOOP_SCHED_WEIGHTED,
+	/* highest priority, but waiting fds gain a level every 16 dispatches */
+	HEV_EVENT_LOOP_SCHED_AGING,
+};
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+/* ns values, 4 buckets per power of two up to 2^40 */
+#define HEV_EVENT_LOOP_HISTOGRAM_SIZE	(160)
+
+struct _HevEventLoopHistogram
+{
+	uint64_t count;
+	uint64_t buckets[HEV_EVENT_LOOP_HISTOGRAM_SIZE];
+};
+
+struct _HevEventLoopStats
+{
+	uint64_t waits;
+	uint64_t events;
+	uint64_t max_events;
+	uint64_t blocked_ns;
+	/* ready fds queued after each wait, summed */
+	uint64_t ready_fds;
+	uint64_t max_ready_fds;
+	uint64_t dispatches;
+	/* waits returning as many events as the batch holds */
+	uint64_t full_batches;
+	uint64_t timers;
+	/* wakeups for timers made unneeded by their slack, roughly, as
+	 * timers firing together had different deadlines: distinct ones
+	 * less one per wakeup, of up to 16 tracked */
+	uint64_t timer_wakeups_saved;
+
+	HevEventLoopHistogram wait_time;
+	/* check and dispatch of a ready fd */
+	HevEventLoopHistogram dispatch_time;
+};
 
 #include "hev-event-source.h"
+#include "hev-timer-wheel.h"
 
 HevEventLoop * hev_event_loop_new (void);
+/* The io_uring backend needs multishot poll (linux 5.13), the loop
+ * falls back to epoll without it, check with get_backend. */
+HevEventLoop * hev_event_loop_new_full (HevEventLoopBackend backend);
 
 HevEventLoop * hev_event_loop_ref (HevEventLoop *self);
 void hev_event_loop_unref (HevEventLoop *self);
@@ -22,11 +84,125 @@ void hev_event_loop_unref (HevEventLoop *self);
 void hev_event_loop_run (HevEventLoop *self);
 void hev_event_loop_quit (HevEventLoop *self);
 
+/* Driving the loop from another one: poll get_fd for reading, up to
+ * get_timeout ms (-1 is forever, as for poll), then iterate. */
+int hev_event_loop_get_fd (HevEventLoop *self);
+int hev_event_loop_get_timeout (HevEventLoop *self);
+/* Polls, waiting for events or the next timer if may_block, and dispatches
+ * one batch (the dispatch budget, or all ready fds, then idle sources).
+ * Returns true if ready fds or idle sources are left, which do not make
+ * the fd readable again. */
+bool hev_event_loop_iterate (HevEventLoop *self, bool may_block);
+
+/* Max number of ready fds dispatched before polling again, 0 is unlimited. */
+void hev_event_loop_set_dispatch_budget (HevEventLoop *self, unsigned int budget);
+unsigned int hev_event_loop_get_dispatch_budget (HevEventLoop *self);
+
+/* Max epoll events taken per wait, 256 by default. With max_size above
+ * size, the batch grows up to it, doubling when a wait fills it, and goes
+ * back down to size when waits keep returning few events. Compare
+ * events/waits and full_batches in the stats to tune it. */
+bool hev_event_loop_set_event_batch (HevEventLoop *self, unsigned int size,
+			unsigned int max_size);
+unsigned int hev_event_loop_get_event_batch (HevEventLoop *self);
+
+/* Statistics of the loop and of its sources (hev_event_source_get_stats),
+ * collected while enabled, off by default. get_stats is NULL if the
+ * library was built without them (make STATS=0). */
+void hev_event_loop_set_stats (HevEventLoop *self, bool enable);
+const HevEventLoopStats * hev_event_loop_get_stats (HevEventLoop *self);
+void hev_event_loop_reset_stats (HevEventLoop *self);
+/* Writes the stats in text to fd, e.g. from a SIGUSR1 signal source. */
+void hev_event_loop_dump_stats (HevEventLoop *self, int fd);
+/* The upper bound in ns of the bucket holding the percentile (0-100). */
+uint64_t hev_event_loop_histogram_percentile (const HevEventLoopHistogram *hist,
+			double percentile);
+
+/* Keeps the last size (rounded up to a power of two) begin and end records
+ * of waits and of each source's check, dispatch and prepare, with the
+ * source's name and fd; 0 stops tracing. Call it on the loop's thread. */
+bool hev_event_loop_set_trace (HevEventLoop *self, unsigned int size);
+/* Writes the records as Chrome trace JSON (chrome://tracing, Perfetto),
+ * may be called from any thread while the loop runs. */
+bool hev_event_loop_dump_trace (HevEventLoop *self, int fd);
+
+/* Starts a thread telling fd about any source whose check, dispatch or
+ * prepare keeps the loop busy for threshold_ms or longer: its name, fd and
+ * the loop thread's backtrace (glibc), taken by a SIGRTMAX - 1 handler on
+ * that thread, which makes the stuck call return EINTR if not restartable.
+ * The loop only stores a heartbeat per dispatch, and marks itself idle
+ * before waiting and when run or iterate returns; 0 stops the watchdog.
+ * Call it on the loop's thread. */
+bool hev_event_loop_set_watchdog (HevEventLoop *self, unsigned int threshold_ms, int fd);
+
+void hev_event_loop_set_sched_policy (HevEventLoop *self, HevEventLoopSchedPolicy policy);
+HevEventLoopSchedPolicy hev_event_loop_get_sched_policy (HevEventLoop *self);
+
+/* Before blocking, poll without blocking for up to max_us: about twice
+ * the average time events took to come lately, or not at all if that is
+ * longer than max_us. 0, the default, always blocks right away. */
+void hev_event_loop_set_busy_poll (HevEventLoop *self, unsigned int max_us);
+unsigned int hev_event_loop_get_busy_poll (HevEventLoop *self);
+/* The kernel's busy polling of the watched sockets' NAPI contexts while
+ * waiting (EPIOCSPARAMS, linux 6.9), epoll backend only. */
+bool hev_event_loop_set_kernel_busy_poll (HevEventLoop *self, unsigned int usecs,
+			unsigned int budget, bool prefer);
+
+/* Off by default. When on, fds added to or deleted from attached sources,
+ * or whose events change, are updated in epoll in one go before the loop
+ * waits again; an add and a del of the same fd in between cancel out and
+ * repeated event changes make one EPOLL_CTL_MOD. Registration errors are
+ * then only seen by flush_changes, which returns false if any failed,
+ * e.g. for a fd already watched by another source of the loop (a source
+ * rejects its own fds twice either way). No effect on the io_uring backend, it batches submissions itself. */
+void hev_event_loop_set_defer_changes (HevEventLoop *self, bool defer);
+bool hev_event_loop_get_defer_changes (HevEventLoop *self);
+bool hev_event_loop_flush_changes (HevEventLoop *self);
+
+HevEventLoopBackend hev_event_loop_get_backend (HevEventLoop *self);
+
+/* Completion based I/O, io_uring backend only, false on epoll. func gets
+ * the result or -errno on the loop's thread, buf (addr) must stay valid
+ * until then. Accepted sockets are non-blocking and close-on-exec. */
+bool hev_event_loop_submit_read (HevEventLoop *self, int fd, void *buf, size_t len,
+			HevEventLoopIOFunc func, void *data);
+bool hev_event_loop_submit_write (HevEventLoop *self, int fd, const void *buf, size_t len,
+			HevEventLoopIOFunc func, void *data);
+bool hev_event_loop_submit_accept (HevEventLoop *self, int fd, struct sockaddr *addr,
+			socklen_t *addr_len, HevEventLoopIOFunc func, void *data);
+
+/* CLOCK_MONOTONIC time, cached each time epoll_wait returns, so it is
+ * free to read in callbacks. hev_event_loop_update_time refreshes it. */
+uint64_t hev_event_loop_now_ns (HevEventLoop *self);
+uint64_t hev_event_loop_now_ms (HevEventLoop *self);
+void hev_event_loop_update_time (HevEventLoop *self);
+
+/* Run func (data) on the loop's thread, may be called from any thread.
+ * Invokes still queued when the loop is freed are dropped. */
+bool hev_event_loop_invoke (HevEventLoop *self, HevEventLoopInvokeFunc func, void *data);
+
 bool hev_event_loop_add_source (HevEventLoop *self, HevEventSource *source);
 bool hev_event_loop_del_source (HevEventLoop *self, HevEventSource *source);
 
 bool _hev_event_loop_add_fd (HevEventLoop *self, HevEventSourceFD *fd);
 bool _hev_event_loop_del_fd (HevEventLoop *self, HevEventSourceFD *fd);
+bool _hev_event_loop_mod_fd (HevEventLoop *self, HevEventSourceFD *fd);
+
+/* Makes a fd (fd -1) ready with EPOLLIN once no other fd is ready, until
+ * the fd is deleted from the loop. */
+void _hev_event_loop_add_idle (HevEventLoop *self, HevEventSourceFD *fd);
+/* Makes a fd ready, e.g. one not backed by a kernel fd (fd -1). */
+void _hev_event_loop_ready_fd (HevEventLoop *self, HevEventSourceFD *fd, uint32_t events);
+/* The loop's shared signalfd source, created on first use. */
+HevEventSource * _hev_event_loop_get_signal_mux (HevEventLoop *self);
+
+/* An expired timer makes its fd (timer->data) ready with EPOLLIN,
+ * expires is in ns of the loop's monotonic time. With slack (ns), it may
+ * fire up to that much later, together with others. Deleting the fd
+ * from the loop deletes its timer. */
+void _hev_event_loop_add_timer (HevEventLoop *self, HevTimerWheelEntry *timer,
+			uint64_t expires, uint64_t slack);
+void _hev_event_loop_del_timer (HevEventLoop *self, HevTimerWheelEntry *timer);
 
 #endif /* __HEV_EVENT_LOOP_H__ */
 
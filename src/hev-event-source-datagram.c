@@ -0,0 +1,411 @@
+/*
+ ============================================================================
+ Name        : hev-event-source-datagram.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2013 everyone.
+ Description : A datagram event source
+ ============================================================================
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+#include "hev-event-source-datagram.h"
+
+#ifndef SOL_UDP
+#define SOL_UDP			(17)
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT		(103)
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO			(104)
+#endif
+
+/* UDP_MAX_SEGMENTS of the first kernels with GSO, and an IP packet */
+#define GSO_MAX_SEGMENTS	(64)
+#define GSO_MAX_SIZE		(65000)
+
+#define RECV_CMSG_SPACE		(CMSG_SPACE (sizeof (int)))
+#define SEND_CMSG_SPACE		(CMSG_SPACE (sizeof (uint16_t)))
+
+static bool hev_event_source_datagram_dispatch (HevEventSource *source,
+			HevEventSourceFD *fd, HevEventSourceFunc callback, void *data);
+static void hev_event_source_datagram_finalize (HevEventSource *source);
+
+struct _HevEventSourceDatagram
+{
+	HevEventSource parent;
+
+	unsigned int batch;
+	size_t buffer_size;
+	bool gro;
+	bool gso;
+	bool dispatching;
+
+	/* received, buffer i of recv_bufs for msg i */
+	HevEventSourceDatagramMsg *msgs;
+	struct mmsghdr *recv_hdrs;
+	struct iovec *recv_iovs;
+	uint8_t *recv_cmsgs;
+	uint8_t *recv_bufs;
+
+	/* to send, a ring of msgs with a buffer each */
+	HevEventSourceDatagramMsg *queue;
+	unsigned int queue_head;
+	unsigned int queue_count;
+	/* each send_hdr a message of send_slots[i] queued datagrams */
+	struct mmsghdr *send_hdrs;
+	struct iovec *send_iovs;
+	unsigned int *send_slots;
+	uint8_t *send_cmsgs;
+	uint8_t *send_bufs;
+};
+
+static HevEventSourceFuncs hev_event_source_datagram_funcs =
+{
+	.prepare = NULL,
+	.check = NULL,
+	.dispatch = hev_event_source_datagram_dispatch,
+	.finalize = hev_event_source_datagram_finalize,
+};
+
+HevEventSource *
+hev_event_source_datagram_new (int fd, unsigned int batch, size_t buffer_size)
+{
+	HevEventSource *source = NULL;
+	HevEventSourceDatagram *self = NULL;
+	unsigned int i = 0;
+
+	if (0 == batch)
+	  batch = HEV_EVENT_SOURCE_DATAGRAM_BATCH;
+	if (0 == buffer_size)
+	  buffer_size = HEV_EVENT_SOURCE_DATAGRAM_BUFFER_SIZE;
+
+	source = hev_event_source_new (&hev_event_source_datagram_funcs,
+				sizeof (HevEventSourceDatagram));
+	if (NULL == source)
+	  return NULL;
+
+	self = (HevEventSourceDatagram *) source;
+	self->batch = batch;
+	self->buffer_size = buffer_size;
+	self->gro = false;
+	self->gso = true;
+	self->dispatching = false;
+	self->queue_head = 0;
+	self->queue_count = 0;
+
+	self->msgs = HEV_MEMORY_ALLOCATOR_ALLOC (sizeof (HevEventSourceDatagramMsg) * batch);
+	self->recv_hdrs = HEV_MEMORY_ALLOCATOR_ALLOC (sizeof (struct mmsghdr) * batch);
+	self->recv_iovs = HEV_MEMORY_ALLOCATOR_ALLOC (sizeof (struct iovec) * batch);
+	self->recv_cmsgs = HEV_MEMORY_ALLOCATOR_ALLOC (RECV_CMSG_SPACE * batch);
+	self->recv_bufs = HEV_MEMORY_ALLOCATOR_ALLOC (buffer_size * batch);
+	self->queue = HEV_MEMORY_ALLOCATOR_ALLOC (sizeof (HevEventSourceDatagramMsg) * batch);
+	self->send_hdrs = HEV_MEMORY_ALLOCATOR_ALLOC (sizeof (struct mmsghdr) * batch);
+	self->send_iovs = HEV_MEMORY_ALLOCATOR_ALLOC (sizeof (struct iovec) * batch);
+	self->send_slots = HEV_MEMORY_ALLOCATOR_ALLOC (sizeof (unsigned int) * batch);
+	self->send_cmsgs = HEV_MEMORY_ALLOCATOR_ALLOC (SEND_CMSG_SPACE * batch);
+	self->send_bufs = HEV_MEMORY_ALLOCATOR_ALLOC (buffer_size * batch);
+	if (!self->msgs || !self->recv_hdrs || !self->recv_iovs || !self->recv_cmsgs ||
+				!self->recv_bufs || !self->queue || !self->send_hdrs ||
+				!self->send_iovs || !self->send_slots || !self->send_cmsgs ||
+				!self->send_bufs) {
+		hev_event_source_unref (source);
+		return NULL;
+	}
+
+	for (i=0; i<batch; i++) {
+		self->msgs[i].data = self->recv_bufs + buffer_size * i;
+		self->recv_iovs[i].iov_base = self->msgs[i].data;
+		self->recv_iovs[i].iov_len = buffer_size;
+		self->queue[i].data = self->send_bufs + buffer_size * i;
+	}
+
+	if (NULL == hev_event_source_add_fd (source, fd, EPOLLIN)) {
+		hev_event_source_unref (source);
+		return NULL;
+	}
+
+	return source;
+}
+
+bool
+hev_event_source_datagram_set_gro (HevEventSource *source, bool enable)
+{
+	HevEventSourceDatagram *self = (HevEventSourceDatagram *) source;
+	int on = enable ? 1 : 0;
+
+	if (0 > setsockopt (source->fds->fd, SOL_UDP, UDP_GRO, &on, sizeof (on)))
+	  return false;
+	self->gro = enable;
+
+	return true;
+}
+
+static int
+datagram_recv (HevEventSourceDatagram *self, int fd)
+{
+	unsigned int i = 0;
+	int count;
+
+	for (i=0; i<self->batch; i++) {
+		struct msghdr *mh = &self->recv_hdrs[i].msg_hdr;
+
+		mh->msg_name = &self->msgs[i].addr;
+		mh->msg_namelen = sizeof (self->msgs[i].addr);
+		mh->msg_iov = &self->recv_iovs[i];
+		mh->msg_iovlen = 1;
+		mh->msg_control = self->gro ? self->recv_cmsgs + RECV_CMSG_SPACE * i : NULL;
+		mh->msg_controllen = self->gro ? RECV_CMSG_SPACE : 0;
+		mh->msg_flags = 0;
+	}
+
+	count = recvmmsg (fd, self->recv_hdrs, self->batch, MSG_DONTWAIT, NULL);
+	for (i=0; (0 < count) && (i<(unsigned int) count); i++) {
+		struct msghdr *mh = &self->recv_hdrs[i].msg_hdr;
+		HevEventSourceDatagramMsg *msg = &self->msgs[i];
+		struct cmsghdr *cm;
+
+		msg->len = self->recv_hdrs[i].msg_len;
+		msg->addr_len = mh->msg_namelen;
+		msg->segment_size = 0;
+		for (cm=CMSG_FIRSTHDR (mh); cm; cm=CMSG_NXTHDR (mh, cm)) {
+			if ((SOL_UDP == cm->cmsg_level) && (UDP_GRO == cm->cmsg_type)) {
+				int size;
+
+				memcpy (&size, CMSG_DATA (cm), sizeof (size));
+				if ((0 < size) && ((size_t) size < msg->len))
+				  msg->segment_size = size;
+			}
+		}
+	}
+
+	return count;
+}
+
+static inline HevEventSourceDatagramMsg *
+queue_slot (HevEventSourceDatagram *self, unsigned int i)
+{
+	return &self->queue[(self->queue_head + i) % self->batch];
+}
+
+/* One message per datagram, or per run of same sized ones to the same
+ * peer with GSO, returns the number of messages. */
+static unsigned int
+send_build (HevEventSourceDatagram *self)
+{
+	unsigned int i = 0, count = 0;
+
+	while (i < self->queue_count) {
+		HevEventSourceDatagramMsg *msg = queue_slot (self, i);
+		struct msghdr *mh = &self->send_hdrs[count].msg_hdr;
+		size_t size = msg->len;
+		unsigned int segs = 1;
+
+		mh->msg_name = msg->addr_len ? &msg->addr : NULL;
+		mh->msg_namelen = msg->addr_len;
+		mh->msg_iov = &self->send_iovs[i];
+		mh->msg_control = NULL;
+		mh->msg_controllen = 0;
+		mh->msg_flags = 0;
+		self->send_iovs[i].iov_base = msg->data;
+		self->send_iovs[i].iov_len = msg->len;
+		i ++;
+
+		/* the last segment may be shorter, it ends the run */
+		while (self->gso && msg->len && (i < self->queue_count) &&
+					(GSO_MAX_SEGMENTS > segs)) {
+			HevEventSourceDatagramMsg *next = queue_slot (self, i);
+
+			if (!next->len || (next->len > msg->len) ||
+						(GSO_MAX_SIZE < (size + next->len)) ||
+						(next->addr_len != msg->addr_len) ||
+						memcmp (&next->addr, &msg->addr, msg->addr_len))
+			  break;
+
+			self->send_iovs[i].iov_base = next->data;
+			self->send_iovs[i].iov_len = next->len;
+			size += next->len;
+			segs ++;
+			i ++;
+			if (next->len < msg->len)
+			  break;
+		}
+
+		mh->msg_iovlen = segs;
+		if (1 < segs) {
+			struct cmsghdr *cm;
+			uint16_t segment_size = msg->len;
+
+			mh->msg_control = self->send_cmsgs + SEND_CMSG_SPACE * count;
+			mh->msg_controllen = SEND_CMSG_SPACE;
+			cm = CMSG_FIRSTHDR (mh);
+			cm->cmsg_level = SOL_UDP;
+			cm->cmsg_type = UDP_SEGMENT;
+			cm->cmsg_len = CMSG_LEN (sizeof (segment_size));
+			memcpy (CMSG_DATA (cm), &segment_size, sizeof (segment_size));
+		}
+		self->send_slots[count] = segs;
+		count ++;
+	}
+
+	return count;
+}
+
+static bool
+datagram_flush (HevEventSourceDatagram *self)
+{
+	HevEventSourceFD *fd = self->parent.fds;
+	uint32_t events;
+
+	while (self->queue_count) {
+		unsigned int count = send_build (self);
+		unsigned int slots = 0;
+		int i, res;
+
+		res = sendmmsg (fd->fd, self->send_hdrs, count, MSG_DONTWAIT);
+		if (0 > res) {
+			if (EINTR == errno)
+			  continue;
+			if ((EAGAIN == errno) || (EWOULDBLOCK == errno))
+			  break;
+			/* no GSO on this path, send them one by one from now on */
+			if (self->gso && (1 < self->send_slots[0]) &&
+						((EINVAL == errno) || (EIO == errno) ||
+						 (ENOPROTOOPT == errno))) {
+				self->gso = false;
+				continue;
+			}
+			/* dropped, as if lost on the way */
+			res = 1;
+		}
+
+		for (i=0; i<res; i++)
+		  slots += self->send_slots[i];
+		self->queue_head = (self->queue_head + slots) % self->batch;
+		self->queue_count -= slots;
+	}
+
+	/* wait for the socket to take the rest */
+	events = hev_event_source_fd_get_events (fd);
+	if (self->queue_count && !(events & EPOLLOUT))
+	  hev_event_source_fd_set_events (fd, events | EPOLLOUT);
+	else if (!self->queue_count && (events & EPOLLOUT))
+	  hev_event_source_fd_set_events (fd, events & ~EPOLLOUT);
+
+	return !self->queue_count;
+}
+
+bool
+hev_event_source_datagram_send (HevEventSource *source, const void *data,
+			size_t len, const struct sockaddr *addr, socklen_t addr_len)
+{
+	HevEventSourceDatagram *self = (HevEventSourceDatagram *) source;
+	HevEventSourceDatagramMsg *msg = NULL;
+	HevEventLoop *loop = NULL;
+
+	if ((self->buffer_size < len) || (addr && (sizeof (msg->addr) < addr_len)))
+	  return false;
+
+	if (self->batch == self->queue_count) {
+		datagram_flush (self);
+		if (self->batch == self->queue_count)
+		  return false;
+	}
+
+	msg = queue_slot (self, self->queue_count);
+	memcpy (msg->data, data, len);
+	msg->len = len;
+	msg->addr_len = 0;
+	if (addr) {
+		memcpy (&msg->addr, addr, addr_len);
+		msg->addr_len = addr_len;
+	}
+	self->queue_count ++;
+
+	/* sent after the dispatch, or else after the loop's next one */
+	loop = hev_event_source_get_loop (source);
+	if (!self->dispatching && loop)
+	  _hev_event_loop_ready_fd (loop, source->fds, EPOLLOUT);
+
+	return true;
+}
+
+bool
+hev_event_source_datagram_flush (HevEventSource *source)
+{
+	return datagram_flush ((HevEventSourceDatagram *) source);
+}
+
+static bool
+hev_event_source_datagram_dispatch (HevEventSource *source, HevEventSourceFD *fd,
+			HevEventSourceFunc callback, void *data)
+{
+	HevEventSourceDatagram *self = (HevEventSourceDatagram *) source;
+	HevEventSourceDatagramFunc _callback = (HevEventSourceDatagramFunc) callback;
+	bool res = true;
+	int count;
+
+	fd->revents &= ~EPOLLOUT;
+	if (!(fd->revents & EPOLLIN)) {
+		datagram_flush (self);
+		return true;
+	}
+
+	count = datagram_recv (self, fd->fd);
+	/* a short batch drained the socket */
+	if (((0 > count) && (EAGAIN == errno)) ||
+				((0 <= count) && (self->batch > (unsigned int) count)))
+	  fd->revents &= ~EPOLLIN;
+	if (0 >= count) {
+		datagram_flush (self);
+		return true;
+	}
+
+	/* the callback may drop the last ref of the source */
+	hev_event_source_ref (source);
+	self->dispatching = true;
+	res = _callback (source, self->msgs, count, data);
+	self->dispatching = false;
+	datagram_flush (self);
+	hev_event_source_unref (source);
+
+	return res;
+}
+
+static void
+hev_event_source_datagram_finalize (HevEventSource *source)
+{
+	HevEventSourceDatagram *self = (HevEventSourceDatagram *) source;
+
+	if (self->msgs)
+	  HEV_MEMORY_ALLOCATOR_FREE (self->msgs);
+	if (self->recv_hdrs)
+	  HEV_MEMORY_ALLOCATOR_FREE (self->recv_hdrs);
+	if (self->recv_iovs)
+	  HEV_MEMORY_ALLOCATOR_FREE (self->recv_iovs);
+	if (self->recv_cmsgs)
+	  HEV_MEMORY_ALLOCATOR_FREE (self->recv_cmsgs);
+	if (self->recv_bufs)
+	  HEV_MEMORY_ALLOCATOR_FREE (self->recv_bufs);
+	if (self->queue)
+	  HEV_MEMORY_ALLOCATOR_FREE (self->queue);
+	if (self->send_hdrs)
+	  HEV_MEMORY_ALLOCATOR_FREE (self->send_hdrs);
+	if (self->send_iovs)
+	  HEV_MEMORY_ALLOCATOR_FREE (self->send_iovs);
+	if (self->send_slots)
+	  HEV_MEMORY_ALLOCATOR_FREE (self->send_slots);
+	if (self->send_cmsgs)
+	  HEV_MEMORY_ALLOCATOR_FREE (self->send_cmsgs);
+	if (self->send_bufs)
+	  HEV_MEMORY_ALLOCATOR_FREE (self->send_bufs);
+}
+
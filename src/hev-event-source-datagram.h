@@ -0,0 +1,60 @@
+/*
+ ============================================================================
+ Name        : hev-event-source-datagram.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2013 everyone.
+ Description : A datagram event source
+ ============================================================================
+ */
+
+#include "hev-event-source.h"
+
+#ifndef __HEV_EVENT_SOURCE_DATAGRAM_H__
+#define __HEV_EVENT_SOURCE_DATAGRAM_H__
+
+#include <sys/socket.h>
+
+#define HEV_EVENT_SOURCE_DATAGRAM_BATCH		(32)
+#define HEV_EVENT_SOURCE_DATAGRAM_BUFFER_SIZE	(2048)
+
+typedef struct _HevEventSourceDatagram HevEventSourceDatagram;
+typedef struct _HevEventSourceDatagramMsg HevEventSourceDatagramMsg;
+typedef bool (*HevEventSourceDatagramFunc) (HevEventSource *source,
+			HevEventSourceDatagramMsg *msgs, unsigned int count, void *data);
+
+struct _HevEventSourceDatagramMsg
+{
+	void *data;
+	size_t len;
+	/* with GRO, datagrams of this size coalesced (the last one may be
+	 * shorter), 0 for a single one */
+	size_t segment_size;
+	socklen_t addr_len;
+	struct sockaddr_storage addr;
+};
+
+/* Reads up to batch datagrams (0 for the default) a dispatch from the
+ * non-blocking socket fd (still the caller's to close) with one recvmmsg,
+ * into the source's buffers of buffer_size bytes (0 for the default, longer
+ * datagrams are truncated), and passes them to the callback. The msgs are
+ * only valid during the call. */
+HevEventSource * hev_event_source_datagram_new (int fd, unsigned int batch,
+			size_t buffer_size);
+
+/* Copies a datagram to the send queue of batch datagrams, addr NULL on a
+ * connected socket. The queue goes out with sendmmsg after the source's
+ * dispatch, or after the loop's next, and is kept until the socket takes
+ * it. Same sized datagrams in a row to the same peer are sent as one
+ * UDP_SEGMENT (GSO, linux 4.18) message, until the kernel refuses one.
+ * False if len is over buffer_size or the queue stays full. */
+bool hev_event_source_datagram_send (HevEventSource *self, const void *data,
+			size_t len, const struct sockaddr *addr, socklen_t addr_len);
+/* Sends what the socket takes now, true if the queue is empty. */
+bool hev_event_source_datagram_flush (HevEventSource *self);
+
+/* The kernel coalesces datagrams of a flow up to buffer_size (UDP_GRO,
+ * linux 5.0), see segment_size. */
+bool hev_event_source_datagram_set_gro (HevEventSource *self, bool enable);
+
+#endif /* __HEV_EVENT_SOURCE_DATAGRAM_H__ */
+
@@ -16,18 +16,43 @@
 #include <stddef.h>
 #include <stdbool.h>
 
+#include "hev-timer-wheel.h"
+
 typedef struct _HevEventSourceFD HevEventSourceFD;
+typedef enum _HevEventSourceFDTrigger HevEventSourceFDTrigger;
+
+enum _HevEventSourceFDTrigger
+{
+	HEV_EVENT_SOURCE_FD_TRIGGER_EDGE,
+	HEV_EVENT_SOURCE_FD_TRIGGER_LEVEL,
+	/* reported once, then disarmed until set_events */
+	HEV_EVENT_SOURCE_FD_TRIGGER_ONESHOT,
+};
 
 struct _HevEventSourceFD
 {
 	int fd;
 	uint32_t _events;
+	uint32_t _trigger;
 	uint32_t revents;
 	uint32_t _dispatched;
+	uint32_t _registered;
+	/* polls armed in the kernel, 0 or 1 on epoll */
+	uint32_t _armed;
+	uint32_t _changed;
+	unsigned int _dispatch_count;
 	unsigned int _ref_count;
 
 	HevEventSource *source;
 	void *data;
+	/* the loop's timer making a fd -1 ready, if any */
+	HevTimerWheelEntry *_timer;
+
+	HevEventSourceFD *_prev;
+	HevEventSourceFD *_next;
+	HevEventSourceFD *_ready_next;
+	HevEventSourceFD *_change_next;
+	HevEventSourceFD *_idle_next;
 };
 
 static inline HevEventSourceFD *
@@ -37,11 +62,22 @@ _hev_event_source_fd_new (HevEventSource *source, int fd, uint32_t events)
 	if (self) {
 		self->fd = fd;
 		self->_events = events;
+		self->_trigger = HEV_EVENT_SOURCE_FD_TRIGGER_EDGE;
 		self->revents = 0;
 		self->_dispatched = 0;
+		self->_registered = 0;
+		self->_armed = 0;
+		self->_changed = 0;
+		self->_dispatch_count = 0;
 		self->_ref_count = 1;
 		self->source = source;
 		self->data = NULL;
+		self->_timer = NULL;
+		self->_prev = NULL;
+		self->_next = NULL;
+		self->_ready_next = NULL;
+		self->_change_next = NULL;
+		self->_idle_next = NULL;
 	}
 
 	return self;
@@ -78,6 +114,22 @@ _hev_event_source_fd_dispatch_finish (HevEventSourceFD *self)
 	_hev_event_source_fd_unref (self);
 }
 
+/* Changes what the loop watches the fd for (EPOLL_CTL_MOD if attached),
+ * a oneshot fd is armed again. EPOLLEXCLUSIVE may be set or cleared here
+ * as well (see hev_event_source_add_fd), e.g. for a shared listening
+ * socket. The kernel refuses EPOLL_CTL_MOD for an EPOLLEXCLUSIVE fd,
+ * such a fd is deleted from epoll and added again:
+ * in between, wakeups go to the other loops watching it only, what is
+ * still pending is reported once it is added again. The same holds for
+ * set_trigger. */
+bool hev_event_source_fd_set_events (HevEventSourceFD *self, uint32_t events);
+uint32_t hev_event_source_fd_get_events (HevEventSourceFD *self);
+
+/* Fds are edge triggered by default. */
+bool hev_event_source_fd_set_trigger (HevEventSourceFD *self,
+			HevEventSourceFDTrigger trigger);
+HevEventSourceFDTrigger hev_event_source_fd_get_trigger (HevEventSourceFD *self);
+
 static inline void
 hev_event_source_fd_set_data (HevEventSourceFD *self, void *data)
 {
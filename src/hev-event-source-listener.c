@@ -0,0 +1,231 @@
+/*
+ ============================================================================
+ Name        : hev-event-source-listener.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2013 everyone.
+ Description : A listener event source
+ ============================================================================
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "hev-event-source-listener.h"
+
+typedef struct _HevEventSourceListenerState HevEventSourceListenerState;
+
+static bool hev_event_source_listener_dispatch (HevEventSource *source,
+			HevEventSourceFD *fd, HevEventSourceFunc callback, void *data);
+static void hev_event_source_listener_finalize (HevEventSource *source);
+
+struct _HevEventSourceListener
+{
+	HevEventSource parent;
+
+	unsigned int budget;
+	int error;
+	HevEventSourceListenerConn *conns;
+
+	size_t state_size;
+	unsigned int pool_size;
+	unsigned int pool_count;
+	/* given out, each holding a ref of the listener */
+	unsigned int states;
+	HevEventSourceListenerState *pool;
+};
+
+/* Put before each state, its size keeps the state aligned. */
+struct _HevEventSourceListenerState
+{
+	HevEventSourceListener *listener;
+	HevEventSourceListenerState *next;
+} __attribute__ ((aligned (16)));
+
+static HevEventSourceFuncs hev_event_source_listener_funcs =
+{
+	.prepare = NULL,
+	.check = NULL,
+	.dispatch = hev_event_source_listener_dispatch,
+	.finalize = hev_event_source_listener_finalize,
+};
+
+HevEventSource *
+hev_event_source_listener_new (int fd, unsigned int budget)
+{
+	HevEventSource *source = NULL;
+	HevEventSourceListener *self = NULL;
+
+	if (0 == budget)
+	  budget = HEV_EVENT_SOURCE_LISTENER_BUDGET;
+
+	source = hev_event_source_new (&hev_event_source_listener_funcs,
+				sizeof (HevEventSourceListener));
+	if (NULL == source)
+	  return NULL;
+
+	self = (HevEventSourceListener *) source;
+	self->budget = budget;
+	self->error = 0;
+	self->state_size = 0;
+	self->pool_size = 0;
+	self->pool_count = 0;
+	self->states = 0;
+	self->pool = NULL;
+	self->conns = HEV_MEMORY_ALLOCATOR_ALLOC (sizeof (HevEventSourceListenerConn) * budget);
+	if (NULL == self->conns) {
+		hev_event_source_unref (source);
+		return NULL;
+	}
+
+	if (NULL == hev_event_source_add_fd (source, fd, EPOLLIN)) {
+		hev_event_source_unref (source);
+		return NULL;
+	}
+	/* a batch a turn, a backlog waits behind the other ready fds */
+	hev_event_source_set_budget (source, 1);
+
+	return source;
+}
+
+static void
+state_pool_clear (HevEventSourceListener *self)
+{
+	while (self->pool) {
+		HevEventSourceListenerState *state = self->pool;
+		self->pool = state->next;
+		HEV_MEMORY_ALLOCATOR_FREE (state);
+	}
+	self->pool_count = 0;
+}
+
+bool
+hev_event_source_listener_set_state (HevEventSource *source, size_t state_size,
+			unsigned int pool_size)
+{
+	HevEventSourceListener *self = (HevEventSourceListener *) source;
+
+	if (self->states)
+	  return false;
+
+	state_pool_clear (self);
+	self->state_size = state_size;
+	self->pool_size = pool_size;
+
+	return true;
+}
+
+static void *
+state_alloc (HevEventSourceListener *self)
+{
+	HevEventSourceListenerState *state = self->pool;
+
+	if (state) {
+		self->pool = state->next;
+		self->pool_count --;
+	} else {
+		state = HEV_MEMORY_ALLOCATOR_ALLOC (sizeof (HevEventSourceListenerState) +
+					self->state_size);
+		if (!state)
+		  return NULL;
+	}
+
+	state->listener = self;
+	state->next = NULL;
+	self->states ++;
+	hev_event_source_ref (&self->parent);
+	memset (state + 1, 0, self->state_size);
+
+	return state + 1;
+}
+
+void
+hev_event_source_listener_state_free (void *ptr)
+{
+	HevEventSourceListenerState *state = NULL;
+	HevEventSourceListener *self = NULL;
+
+	if (!ptr)
+	  return;
+
+	state = (HevEventSourceListenerState *) ptr - 1;
+	self = state->listener;
+
+	if (self->pool_count < self->pool_size) {
+		state->next = self->pool;
+		self->pool = state;
+		self->pool_count ++;
+	} else {
+		HEV_MEMORY_ALLOCATOR_FREE (state);
+	}
+
+	self->states --;
+	hev_event_source_unref (&self->parent);
+}
+
+int
+hev_event_source_listener_get_error (HevEventSource *source)
+{
+	HevEventSourceListener *self = (HevEventSourceListener *) source;
+
+	return self->error;
+}
+
+static bool
+hev_event_source_listener_dispatch (HevEventSource *source, HevEventSourceFD *fd,
+			HevEventSourceFunc callback, void *data)
+{
+	HevEventSourceListener *self = (HevEventSourceListener *) source;
+	HevEventSourceListenerFunc _callback = (HevEventSourceListenerFunc) callback;
+	unsigned int count = 0;
+
+	self->error = 0;
+	while (count < self->budget) {
+		HevEventSourceListenerConn *conn = &self->conns[count];
+
+		conn->addr_len = sizeof (conn->addr);
+		conn->fd = accept4 (fd->fd, (struct sockaddr *) &conn->addr,
+					&conn->addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (0 > conn->fd) {
+			/* gone before being accepted, try the next one */
+			if ((ECONNABORTED == errno) || (EPROTO == errno) || (EINTR == errno))
+			  continue;
+			/* drained, or out of fds: not busy looping on it */
+			if (EAGAIN != errno)
+			  self->error = errno;
+			fd->revents &= ~EPOLLIN;
+			break;
+		}
+
+		conn->state = NULL;
+		if (self->state_size) {
+			conn->state = state_alloc (self);
+			if (!conn->state) {
+				close (conn->fd);
+				self->error = ENOMEM;
+				fd->revents &= ~EPOLLIN;
+				break;
+			}
+		}
+		count ++;
+	}
+
+	/* drained already, nothing to tell */
+	if (!count && !self->error)
+	  return true;
+
+	return _callback (source, self->conns, count, data);
+}
+
+static void
+hev_event_source_listener_finalize (HevEventSource *source)
+{
+	HevEventSourceListener *self = (HevEventSourceListener *) source;
+
+	state_pool_clear (self);
+	if (self->conns)
+	  HEV_MEMORY_ALLOCATOR_FREE (self->conns);
+}
+
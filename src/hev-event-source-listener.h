@@ -0,0 +1,56 @@
+/*
+ ============================================================================
+ Name        : hev-event-source-listener.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2013 everyone.
+ Description : A listener event source
+ ============================================================================
+ */
+
+#include "hev-event-source.h"
+
+#ifndef __HEV_EVENT_SOURCE_LISTENER_H__
+#define __HEV_EVENT_SOURCE_LISTENER_H__
+
+#include <sys/socket.h>
+
+#define HEV_EVENT_SOURCE_LISTENER_BUDGET	(64)
+
+typedef struct _HevEventSourceListener HevEventSourceListener;
+typedef struct _HevEventSourceListenerConn HevEventSourceListenerConn;
+typedef bool (*HevEventSourceListenerFunc) (HevEventSource *source,
+			HevEventSourceListenerConn *conns, unsigned int count, void *data);
+
+struct _HevEventSourceListenerConn
+{
+	int fd;
+	socklen_t addr_len;
+	struct sockaddr_storage addr;
+	/* from the listener's pool, NULL without set_state */
+	void *state;
+};
+
+/* Accepts from the listening socket fd (non-blocking, still the caller's
+ * to close) up to budget connections a dispatch, 0 for the default, and
+ * passes them to the callback in one call, or none after an error (see
+ * get_error). The accepted fds are non-blocking and close-on-exec, the
+ * callback takes them and the conns are only valid during the call. A
+ * longer queue is taken on after the other ready fds of the source's
+ * priority (the source's budget is 1). For a socket shared by loops,
+ * hev_event_source_fd_set_events (source->fds, EPOLLIN | EPOLLEXCLUSIVE). */
+HevEventSource * hev_event_source_listener_new (int fd, unsigned int budget);
+
+/* Gives each connection state_size zeroed bytes (conn->state), reusing up
+ * to pool_size freed states before allocating. Fails while states are out. */
+bool hev_event_source_listener_set_state (HevEventSource *self, size_t state_size,
+			unsigned int pool_size);
+/* Back to the pool, the listener stays alive until all its states are.
+ * Call it on the listener's loop thread. */
+void hev_event_source_listener_state_free (void *state);
+
+/* The errno of the last dispatch's failed accept other than EAGAIN, e.g.
+ * EMFILE, 0 if none. The fd then waits for the next wakeup. */
+int hev_event_source_listener_get_error (HevEventSource *self);
+
+#endif /* __HEV_EVENT_SOURCE_LISTENER_H__ */
+
@@ -0,0 +1,356 @@
+/*
+ ============================================================================
+ Name        : hev-event-source-relay.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2013 everyone.
+ Description : A relay event source
+ ============================================================================
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "hev-event-source-relay.h"
+#include "hev-ring-buffer.h"
+
+typedef struct _HevEventSourceRelayPath HevEventSourceRelayPath;
+
+static bool hev_event_source_relay_dispatch (HevEventSource *source,
+			HevEventSourceFD *fd, HevEventSourceFunc callback, void *data);
+static void hev_event_source_relay_finalize (HevEventSource *source);
+
+/* One direction, from in to out. */
+struct _HevEventSourceRelayPath
+{
+	HevEventSourceFD *in;
+	HevEventSourceFD *out;
+
+	/* splicing while pipe[0] is not -1, copying through buffer else */
+	int pipe[2];
+	size_t capacity;
+	HevRingBuffer *buffer;
+	/* read from in, not written to out yet */
+	size_t pending;
+	uint64_t bytes;
+
+	/* edge triggered, ready until EAGAIN */
+	bool readable;
+	bool writable;
+	/* end of in seen, out shut down */
+	bool eof;
+	bool done;
+};
+
+struct _HevEventSourceRelay
+{
+	HevEventSource parent;
+
+	HevEventSourceRelayPath paths[2];
+	bool finished;
+};
+
+static HevEventSourceFuncs hev_event_source_relay_funcs =
+{
+	.prepare = NULL,
+	.check = NULL,
+	.dispatch = hev_event_source_relay_dispatch,
+	.finalize = hev_event_source_relay_finalize,
+};
+
+static bool
+path_copy (HevEventSourceRelayPath *path)
+{
+	path->buffer = hev_ring_buffer_new (HEV_EVENT_SOURCE_RELAY_BUFFER_SIZE);
+	if (!path->buffer)
+	  return false;
+	path->capacity = HEV_EVENT_SOURCE_RELAY_BUFFER_SIZE;
+
+	return true;
+}
+
+static bool
+path_init (HevEventSourceRelayPath *path, HevEventSourceFD *in,
+			HevEventSourceFD *out, bool splice)
+{
+	int size;
+
+	path->in = in;
+	path->out = out;
+	path->pipe[0] = -1;
+	path->pipe[1] = -1;
+	path->buffer = NULL;
+	path->pending = 0;
+	path->bytes = 0;
+	path->readable = false;
+	path->writable = false;
+	path->eof = false;
+	path->done = false;
+
+	/* out of fds for pipes is no reason to fail */
+	if (!splice || (0 > pipe2 (path->pipe, O_NONBLOCK | O_CLOEXEC))) {
+		path->pipe[0] = -1;
+		return path_copy (path);
+	}
+
+	size = fcntl (path->pipe[1], F_GETPIPE_SZ);
+	path->capacity = (0 < size) ? size : HEV_EVENT_SOURCE_RELAY_BUFFER_SIZE;
+
+	return true;
+}
+
+static void
+path_fini (HevEventSourceRelayPath *path)
+{
+	if (0 <= path->pipe[0]) {
+		close (path->pipe[0]);
+		close (path->pipe[1]);
+	}
+	hev_ring_buffer_unref (path->buffer);
+}
+
+HevEventSource *
+hev_event_source_relay_new (int fd_a, int fd_b, bool splice)
+{
+	HevEventSource *source = NULL;
+	HevEventSourceRelay *self = NULL;
+	HevEventSourceFD *a, *b;
+
+	source = hev_event_source_new (&hev_event_source_relay_funcs,
+				sizeof (HevEventSourceRelay));
+	if (NULL == source)
+	  return NULL;
+
+	self = (HevEventSourceRelay *) source;
+	self->finished = false;
+	self->paths[0].pipe[0] = -1;
+	self->paths[0].buffer = NULL;
+	self->paths[1].pipe[0] = -1;
+	self->paths[1].buffer = NULL;
+
+	a = hev_event_source_add_fd (source, fd_a, EPOLLIN);
+	b = hev_event_source_add_fd (source, fd_b, EPOLLIN);
+	if (!a || !b ||
+				!path_init (&self->paths[HEV_EVENT_SOURCE_RELAY_FORWARD], a, b, splice) ||
+				!path_init (&self->paths[HEV_EVENT_SOURCE_RELAY_BACKWARD], b, a, splice)) {
+		hev_event_source_unref (source);
+		return NULL;
+	}
+
+	return source;
+}
+
+bool
+hev_event_source_relay_get_splice (HevEventSource *source)
+{
+	HevEventSourceRelay *self = (HevEventSourceRelay *) source;
+
+	return (0 <= self->paths[0].pipe[0]) && (0 <= self->paths[1].pipe[0]);
+}
+
+uint64_t
+hev_event_source_relay_get_bytes (HevEventSource *source,
+			HevEventSourceRelayDirection direction)
+{
+	HevEventSourceRelay *self = (HevEventSourceRelay *) source;
+
+	return self->paths[direction].bytes;
+}
+
+static ssize_t
+path_read (HevEventSourceRelayPath *path)
+{
+	struct iovec iovec[2];
+	size_t iovec_len;
+	ssize_t size;
+
+	if (0 <= path->pipe[0])
+	  return splice (path->in->fd, NULL, path->pipe[1], NULL,
+				  path->capacity - path->pending,
+				  SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+	iovec_len = hev_ring_buffer_writing (path->buffer, iovec);
+	size = readv (path->in->fd, iovec, iovec_len);
+	if (0 < size)
+	  hev_ring_buffer_write_finish (path->buffer, size);
+
+	return size;
+}
+
+static ssize_t
+path_write (HevEventSourceRelayPath *path)
+{
+	struct iovec iovec[2];
+	struct msghdr msg;
+	size_t iovec_len;
+	ssize_t size;
+
+	if (0 <= path->pipe[0])
+	  return splice (path->pipe[0], NULL, path->out->fd, NULL, path->pending,
+				  SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+	iovec_len = hev_ring_buffer_reading (path->buffer, iovec);
+	/* a reset peer is an EPIPE, not a SIGPIPE */
+	memset (&msg, 0, sizeof (msg));
+	msg.msg_iov = iovec;
+	msg.msg_iovlen = iovec_len;
+	size = sendmsg (path->out->fd, &msg, MSG_NOSIGNAL);
+	if ((0 > size) && (ENOTSOCK == errno))
+	  size = writev (path->out->fd, iovec, iovec_len);
+	if (0 < size)
+	  hev_ring_buffer_read_finish (path->buffer, size);
+
+	return size;
+}
+
+/* The fds can't splice, the pipe's data goes to the buffer first. */
+static bool
+path_fall_back (HevEventSourceRelayPath *path)
+{
+	if (!path_copy (path))
+	  return false;
+
+	while (path->pending) {
+		struct iovec iovec[2];
+		size_t iovec_len;
+		ssize_t size;
+
+		iovec_len = hev_ring_buffer_writing (path->buffer, iovec);
+		size = readv (path->pipe[0], iovec, iovec_len);
+		if (0 >= size)
+		  break;
+		hev_ring_buffer_write_finish (path->buffer, size);
+		path->pending -= size;
+	}
+	/* more than the buffer holds, with a grown pipe */
+	if (path->pending) {
+		errno = EINVAL;
+		return false;
+	}
+
+	close (path->pipe[0]);
+	close (path->pipe[1]);
+	path->pipe[0] = -1;
+	path->pipe[1] = -1;
+
+	return true;
+}
+
+/* Moves all it can, false on errors. */
+static bool
+path_move (HevEventSourceRelayPath *path)
+{
+	bool moved = true;
+
+	while (moved) {
+		ssize_t size;
+
+		moved = false;
+		if (path->readable && !path->eof && (path->pending < path->capacity)) {
+			size = path_read (path);
+			if (0 < size) {
+				path->pending += size;
+				moved = true;
+			} else if (0 == size) {
+				path->eof = true;
+				moved = true;
+			} else if (EAGAIN == errno) {
+				/* or the pipe is full, while it holds anything */
+				if (!path->pending)
+				  path->readable = false;
+			} else if ((EINVAL == errno) && (0 <= path->pipe[0])) {
+				if (!path_fall_back (path))
+				  return false;
+				moved = true;
+			} else if (EINTR != errno) {
+				return false;
+			}
+		}
+
+		if (path->writable && path->pending) {
+			size = path_write (path);
+			if (0 < size) {
+				path->pending -= size;
+				path->bytes += size;
+				moved = true;
+			} else if (EAGAIN == errno) {
+				path->writable = false;
+			} else if ((EINVAL == errno) && (0 <= path->pipe[0])) {
+				if (!path_fall_back (path))
+				  return false;
+				moved = true;
+			} else if (EINTR != errno) {
+				return false;
+			}
+		}
+
+		if (path->eof && !path->pending && !path->done) {
+			shutdown (path->out->fd, SHUT_WR);
+			path->done = true;
+		}
+	}
+
+	return true;
+}
+
+/* Only wakes up for EPOLLOUT while data waits for the fd. */
+static void
+path_watch_out (HevEventSourceRelayPath *path)
+{
+	uint32_t events = hev_event_source_fd_get_events (path->out);
+
+	if (path->pending && !(EPOLLOUT & events))
+	  hev_event_source_fd_set_events (path->out, events | EPOLLOUT);
+	else if (!path->pending && (EPOLLOUT & events))
+	  hev_event_source_fd_set_events (path->out, events & ~EPOLLOUT);
+}
+
+static bool
+hev_event_source_relay_dispatch (HevEventSource *source, HevEventSourceFD *fd,
+			HevEventSourceFunc callback, void *data)
+{
+	HevEventSourceRelay *self = (HevEventSourceRelay *) source;
+	HevEventSourceRelayFunc _callback = (HevEventSourceRelayFunc) callback;
+	HevEventSourceRelayPath *in_path, *out_path;
+	int error = 0;
+
+	/* errors and hangups show up in the next read or write */
+	in_path = &self->paths[(fd == self->paths[0].in) ? 0 : 1];
+	out_path = &self->paths[(fd == self->paths[0].out) ? 0 : 1];
+	if ((EPOLLIN | EPOLLERR | EPOLLHUP) & fd->revents)
+	  in_path->readable = true;
+	if ((EPOLLOUT | EPOLLERR | EPOLLHUP) & fd->revents)
+	  out_path->writable = true;
+	fd->revents = 0;
+	if (self->finished)
+	  return true;
+
+	if (!path_move (&self->paths[0]) || !path_move (&self->paths[1]))
+	  error = errno ? errno : EIO;
+	if (!error && !(self->paths[0].done && self->paths[1].done)) {
+		path_watch_out (&self->paths[0]);
+		path_watch_out (&self->paths[1]);
+		return true;
+	}
+
+	self->finished = true;
+	if (!_callback)
+	  return false;
+
+	return _callback (source, error, data);
+}
+
+static void
+hev_event_source_relay_finalize (HevEventSource *source)
+{
+	HevEventSourceRelay *self = (HevEventSourceRelay *) source;
+
+	path_fini (&self->paths[0]);
+	path_fini (&self->paths[1]);
+}
+
@@ -0,0 +1,50 @@
+/*
+ ============================================================================
+ Name        : hev-event-source-relay.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2013 everyone.
+ Description : A relay event source
+ ============================================================================
+ */
+
+#include "hev-event-source.h"
+
+#ifndef __HEV_EVENT_SOURCE_RELAY_H__
+#define __HEV_EVENT_SOURCE_RELAY_H__
+
+#include <stdint.h>
+
+#define HEV_EVENT_SOURCE_RELAY_BUFFER_SIZE	(65536)
+
+typedef struct _HevEventSourceRelay HevEventSourceRelay;
+typedef enum _HevEventSourceRelayDirection HevEventSourceRelayDirection;
+typedef bool (*HevEventSourceRelayFunc) (HevEventSource *source, int error, void *data);
+
+enum _HevEventSourceRelayDirection
+{
+	/* from fd a to fd b */
+	HEV_EVENT_SOURCE_RELAY_FORWARD,
+	HEV_EVENT_SOURCE_RELAY_BACKWARD,
+};
+
+/* Relays bytes both ways between the non-blocking stream fds a and b (still
+ * the caller's to close), b may still be connecting. With splice, through
+ * a pipe per direction with splice (SPLICE_F_MOVE), not copied to user
+ * space; else, or once splice fails with EINVAL for these fds, through
+ * ring buffers of HEV_EVENT_SOURCE_RELAY_BUFFER_SIZE bytes. When the
+ * input of a direction ends, its output is shut down for writing once
+ * all is written. The callback is called with error 0 when both
+ * directions are done, or with the errno of the first failure. The
+ * copying path writes with MSG_NOSIGNAL, but splice has no such flag:
+ * with splice, SIGPIPE must be ignored or blocked, or a peer closing or
+ * resetting its end kills the process. */
+HevEventSource * hev_event_source_relay_new (int fd_a, int fd_b, bool splice);
+
+/* False once a direction fell back to copying. */
+bool hev_event_source_relay_get_splice (HevEventSource *self);
+/* Bytes written to the output of the direction so far. */
+uint64_t hev_event_source_relay_get_bytes (HevEventSource *self,
+			HevEventSourceRelayDirection direction);
+
+#endif /* __HEV_EVENT_SOURCE_RELAY_H__ */
+
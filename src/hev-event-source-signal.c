@@ -8,61 +8,72 @@
  */
 
 #include <errno.h>
+#include <string.h>
 #include <unistd.h>
 #include <signal.h>
 #include <sys/epoll.h>
 #if defined(ANDROID)
 #include <fcntl.h>
 #include <asm/unistd.h>
-#else /* GENERIC */
-#include <sys/signalfd.h>
 #endif
 
 #include "hev-event-source-signal.h"
 
+#define SIGNAL_MUX_BATCH	(16)
+
+typedef struct _HevEventSourceSignalMux HevEventSourceSignalMux;
+
+static bool hev_event_source_signal_prepare (HevEventSource *source);
 static bool hev_event_source_signal_check (HevEventSource *source, HevEventSourceFD *fd);
 static void hev_event_source_signal_finalize (HevEventSource *source);
+static bool hev_event_source_signal_mux_dispatch (HevEventSource *source,
+			HevEventSourceFD *fd, HevEventSourceFunc callback, void *data);
+static void hev_event_source_signal_mux_finalize (HevEventSource *source);
 
 struct _HevEventSourceSignal
 {
 	HevEventSource parent;
 
+	int signal;
+	/* the mux of the loop attached to, and the next source of its signal */
+	HevEventSourceSignalMux *mux;
+	HevEventSourceSignal *mux_next;
+
+	unsigned int queue_head;
+	unsigned int queue_count;
+	struct signalfd_siginfo queue[HEV_EVENT_SOURCE_SIGNAL_QUEUE_SIZE];
+	struct signalfd_siginfo info;
+};
+
+struct _HevEventSourceSignalMux
+{
+	HevEventSource parent;
+
 	int signal_fd;
+	sigset_t mask;
+	HevEventSourceSignal *sources[_NSIG];
 };
 
 #if defined(ANDROID)
 #define SFD_NONBLOCK	O_NONBLOCK
-
-struct signalfd_siginfo
-{
-  uint32_t ssi_signo;
-  int32_t ssi_errno;
-  int32_t ssi_code;
-  uint32_t ssi_pid;
-  uint32_t ssi_uid;
-  int32_t ssi_fd;
-  uint32_t ssi_tid;
-  uint32_t ssi_band;
-  uint32_t ssi_overrun;
-  uint32_t ssi_trapno;
-  int32_t ssi_status;
-  int32_t ssi_int;
-  uint64_t ssi_ptr;
-  uint64_t ssi_utime;
-  uint64_t ssi_stime;
-  uint64_t ssi_addr;
-  uint8_t __pad[48];
-};
 #endif
 
 static HevEventSourceFuncs hev_event_source_signal_funcs =
 {
-	.prepare = NULL,
+	.prepare = hev_event_source_signal_prepare,
 	.check = hev_event_source_signal_check,
 	.dispatch = NULL,
 	.finalize = hev_event_source_signal_finalize,
 };
 
+static HevEventSourceFuncs hev_event_source_signal_mux_funcs =
+{
+	.prepare = NULL,
+	.check = NULL,
+	.dispatch = hev_event_source_signal_mux_dispatch,
+	.finalize = hev_event_source_signal_mux_finalize,
+};
+
 #if defined(ANDROID)
 static int
 signalfd (int fd, const sigset_t *mask, int flags)
@@ -74,54 +85,221 @@ signalfd (int fd, const sigset_t *mask, int flags)
 HevEventSource *
 hev_event_source_signal_new (int signal)
 {
-	int fd = -1;
 	HevEventSource *source = NULL;
 	HevEventSourceSignal *self = NULL;
 	sigset_t mask;
 
+	if ((0 >= signal) || (_NSIG <= signal))
+	  return NULL;
+
+	/* blocked now, not to be missed until the source is attached */
 	sigemptyset (&mask);
 	sigaddset (&mask, signal);
-	sigprocmask(SIG_BLOCK, &mask, NULL);
+	sigprocmask (SIG_BLOCK, &mask, NULL);
+
+	source = hev_event_source_new (&hev_event_source_signal_funcs,
+				sizeof (HevEventSourceSignal));
+	if (NULL == source)
+	  return NULL;
+
+	/* no fd of its own, the loop's mux makes this one ready */
+	if (NULL == hev_event_source_add_fd (source, -1, EPOLLIN)) {
+		hev_event_source_unref (source);
+		return NULL;
+	}
+
+	self = (HevEventSourceSignal *) source;
+	self->signal = signal;
+	self->mux = NULL;
+	self->mux_next = NULL;
+	self->queue_head = 0;
+	self->queue_count = 0;
+	memset (&self->info, 0, sizeof (self->info));
+
+	return source;
+}
+
+const struct signalfd_siginfo *
+hev_event_source_signal_get_info (HevEventSource *source)
+{
+	HevEventSourceSignal *self = (HevEventSourceSignal *) source;
+
+	return &self->info;
+}
+
+static void
+signal_mux_detach (HevEventSourceSignal *self)
+{
+	HevEventSourceSignal **prev;
+
+	if (!self->mux)
+	  return;
+
+	prev = &self->mux->sources[self->signal];
+	for (; *prev; prev=&(*prev)->mux_next) {
+		if (*prev == self) {
+			*prev = self->mux_next;
+			break;
+		}
+	}
+	self->mux_next = NULL;
+	hev_event_source_unref (&self->mux->parent);
+	self->mux = NULL;
+	self->queue_count = 0;
+}
+
+static bool
+signal_mux_attach (HevEventSourceSignal *self, HevEventSourceSignalMux *mux)
+{
+	if (!sigismember (&mux->mask, self->signal)) {
+		sigset_t mask = mux->mask;
+
+		sigaddset (&mask, self->signal);
+		if (-1 == signalfd (mux->signal_fd, &mask, SFD_NONBLOCK))
+		  return false;
+		mux->mask = mask;
+	}
+
+	self->mux = (HevEventSourceSignalMux *) hev_event_source_ref (&mux->parent);
+	self->mux_next = mux->sources[self->signal];
+	mux->sources[self->signal] = self;
+
+	return true;
+}
+
+static bool
+hev_event_source_signal_prepare (HevEventSource *source)
+{
+	HevEventSourceSignal *self = (HevEventSourceSignal *) source;
+	HevEventLoop *loop = hev_event_source_get_loop (source);
+	HevEventSource *mux;
+
+	/* called after each dispatch too, attached to this loop already */
+	if (self->mux && (hev_event_source_get_loop (&self->mux->parent) == loop))
+	  return true;
+
+	signal_mux_detach (self);
+	mux = _hev_event_loop_get_signal_mux (loop);
+	if (mux)
+	  signal_mux_attach (self, (HevEventSourceSignalMux *) mux);
+
+	return true;
+}
+
+static bool
+hev_event_source_signal_check (HevEventSource *source, HevEventSourceFD *fd)
+{
+	HevEventSourceSignal *self = (HevEventSourceSignal *) source;
+
+	if (!self->queue_count) {
+		fd->revents &= ~EPOLLIN;
+		return false;
+	}
+
+	self->info = self->queue[self->queue_head];
+	self->queue_head = (self->queue_head + 1) % HEV_EVENT_SOURCE_SIGNAL_QUEUE_SIZE;
+	self->queue_count --;
+	if (!self->queue_count)
+	  fd->revents &= ~EPOLLIN;
+
+	return true;
+}
+
+static void
+hev_event_source_signal_finalize (HevEventSource *source)
+{
+	HevEventSourceSignal *self = (HevEventSourceSignal *) source;
+
+	signal_mux_detach (self);
+}
+
+HevEventSource *
+_hev_event_source_signal_mux_new (void)
+{
+	HevEventSource *source = NULL;
+	HevEventSourceSignalMux *self = NULL;
+	sigset_t mask;
+	int fd;
+
+	sigemptyset (&mask);
 	fd = signalfd (-1, &mask, SFD_NONBLOCK);
 	if (-1 == fd)
 	  return NULL;
 
-	source = hev_event_source_new (&hev_event_source_signal_funcs,
-				sizeof (HevEventSourceSignal));
+	source = hev_event_source_new (&hev_event_source_signal_mux_funcs,
+				sizeof (HevEventSourceSignalMux));
 	if (NULL == source) {
 		close (fd);
 		return NULL;
 	}
+	hev_event_source_set_name (source, "signal-mux");
 
-	self = (HevEventSourceSignal *) source;
+	self = (HevEventSourceSignalMux *) source;
 	self->signal_fd = fd;
+	self->mask = mask;
+	memset (self->sources, 0, sizeof (self->sources));
 	hev_event_source_add_fd (source, self->signal_fd, EPOLLIN | EPOLLET);
 
 	return source;
 }
 
-static bool
-hev_event_source_signal_check (HevEventSource *source, HevEventSourceFD *fd)
+static void
+signal_mux_route (HevEventSourceSignalMux *self, const struct signalfd_siginfo *info)
 {
-	HevEventSourceSignal *self = (HevEventSourceSignal *) source;
-	if (EPOLLIN & fd->revents) {
-		struct signalfd_siginfo siginfo;
-		int size = read (self->signal_fd, &siginfo, sizeof (struct signalfd_siginfo));
-		if (-1 == size) {
-			if (EAGAIN == errno)
-			  fd->revents &= ~EPOLLIN;
-			return false;
+	HevEventLoop *loop = hev_event_source_get_loop (&self->parent);
+	HevEventSourceSignal *signal;
+
+	if (_NSIG <= info->ssi_signo)
+	  return;
+
+	for (signal=self->sources[info->ssi_signo]; signal; signal=signal->mux_next) {
+		unsigned int tail;
+
+		/* removed from the loop, still attached until added again */
+		if (hev_event_source_get_loop (&signal->parent) != loop)
+		  continue;
+
+		/* full, the oldest are kept, like the kernel merges signals */
+		if (HEV_EVENT_SOURCE_SIGNAL_QUEUE_SIZE > signal->queue_count) {
+			tail = (signal->queue_head + signal->queue_count) %
+				HEV_EVENT_SOURCE_SIGNAL_QUEUE_SIZE;
+			signal->queue[tail] = *info;
+			signal->queue_count ++;
 		}
+		_hev_event_loop_ready_fd (loop, signal->parent.fds, EPOLLIN);
+	}
+}
+
+static bool
+hev_event_source_signal_mux_dispatch (HevEventSource *source, HevEventSourceFD *fd,
+			HevEventSourceFunc callback, void *data)
+{
+	HevEventSourceSignalMux *self = (HevEventSourceSignalMux *) source;
+	struct signalfd_siginfo infos[SIGNAL_MUX_BATCH];
+	ssize_t i, size;
+
+	size = read (self->signal_fd, infos, sizeof (infos));
+	if (-1 == size) {
+		if (EAGAIN == errno)
+		  fd->revents &= ~EPOLLIN;
 		return true;
 	}
 
-	return false;
+	size /= sizeof (struct signalfd_siginfo);
+	for (i=0; i<size; i++)
+	  signal_mux_route (self, &infos[i]);
+	/* a short read drained it */
+	if (SIGNAL_MUX_BATCH > size)
+	  fd->revents &= ~EPOLLIN;
+
+	return true;
 }
 
 static void
-hev_event_source_signal_finalize (HevEventSource *source)
+hev_event_source_signal_mux_finalize (HevEventSource *source)
 {
-	HevEventSourceSignal *self = (HevEventSourceSignal *) source;
+	HevEventSourceSignalMux *self = (HevEventSourceSignalMux *) source;
+
 	close (self->signal_fd);
 }
 
@@ -12,9 +12,47 @@
 #ifndef __HEV_EVENT_SOURCE_SIGNAL_H__
 #define __HEV_EVENT_SOURCE_SIGNAL_H__
 
+#include <stdint.h>
+#if defined(ANDROID)
+struct signalfd_siginfo
+{
+  uint32_t ssi_signo;
+  int32_t ssi_errno;
+  int32_t ssi_code;
+  uint32_t ssi_pid;
+  uint32_t ssi_uid;
+  int32_t ssi_fd;
+  uint32_t ssi_tid;
+  uint32_t ssi_band;
+  uint32_t ssi_overrun;
+  uint32_t ssi_trapno;
+  int32_t ssi_status;
+  int32_t ssi_int;
+  uint64_t ssi_ptr;
+  uint64_t ssi_utime;
+  uint64_t ssi_stime;
+  uint64_t ssi_addr;
+  uint8_t __pad[48];
+};
+#else /* GENERIC */
+#include <sys/signalfd.h>
+#endif
+
+/* Signals not taken yet are kept per source up to this many. */
+#define HEV_EVENT_SOURCE_SIGNAL_QUEUE_SIZE	(8)
+
 typedef struct _HevEventSourceSignal HevEventSourceSignal;
 
+/* The signal is blocked, then read from one signalfd shared by the
+ * signal sources of a loop, whose mask only grows. */
 HevEventSource * hev_event_source_signal_new (int signal);
 
+/* The siginfo of the signal being dispatched, e.g. ssi_pid and ssi_status
+ * of a SIGCHLD; the callback runs once for each signal received. */
+const struct signalfd_siginfo * hev_event_source_signal_get_info (HevEventSource *source);
+
+/* The loop's signalfd, routing what it reads to the signal sources. */
+HevEventSource * _hev_event_source_signal_mux_new (void);
+
 #endif /* __HEV_EVENT_SOURCE_SIGNAL_H__ */
 
@@ -7,24 +7,10 @@
  ============================================================================
  */
 
-#include <time.h>
-#include <errno.h>
-#include <unistd.h>
 #include <sys/epoll.h>
-#if defined(ANDROID)
-#include <fcntl.h>
-#include <asm/unistd.h>
-#else /* GENERIC */
-#include <sys/timerfd.h>
-#endif
 
 #include "hev-event-source-timeout.h"
 
-#if defined(ANDROID)
-#define TFD_NONBLOCK	O_NONBLOCK
-#define TFD_TIMER_ABSTIME 1
-#endif
-
 static bool hev_event_source_timeout_prepare (HevEventSource *source);
 static bool hev_event_source_timeout_check (HevEventSource *source, HevEventSourceFD *fd);
 static void hev_event_source_timeout_finalize (HevEventSource *source);
@@ -33,8 +19,13 @@ struct _HevEventSourceTimeout
 {
 	HevEventSource parent;
 
-	int timer_fd;
-	unsigned int interval;
+	HevTimerWheelEntry timer;
+	HevEventSourceTimeoutMode mode;
+	uint64_t interval;
+	/* ns of the loop's clock the timer is set to, 0 until first set */
+	uint64_t deadline;
+	uint64_t overruns;
+	uint64_t slack;
 };
 
 static HevEventSourceFuncs hev_event_source_timeout_funcs =
@@ -45,59 +36,94 @@ static HevEventSourceFuncs hev_event_source_timeout_funcs =
 	.finalize = hev_event_source_timeout_finalize,
 };
 
-#if defined(ANDROID)
-static int
-timerfd_create (int clockid, int flags)
-{
-	return syscall (__NR_timerfd_create, clockid, flags);
-}
-
-static int
-timerfd_settime (int fd, int flags,
-			const struct itimerspec *new_value,
-			struct itimerspec *old_value)
+HevEventSource *
+hev_event_source_timeout_new (unsigned int interval)
 {
-	return syscall (__NR_timerfd_settime, fd, flags, new_value, old_value);
+	return hev_event_source_timeout_new_full ((uint64_t) interval * 1000 * 1000,
+				HEV_EVENT_SOURCE_TIMEOUT_RELATIVE);
 }
-#endif
 
 HevEventSource *
-hev_event_source_timeout_new (unsigned int interval)
+hev_event_source_timeout_new_full (uint64_t interval, HevEventSourceTimeoutMode mode)
 {
-	int fd = -1;
 	HevEventSource *source = NULL;
 	HevEventSourceTimeout *self = NULL;
-
-	fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK);
-	if (-1 == fd)
-	  return NULL;
+	HevEventSourceFD *fd = NULL;
 
 	source = hev_event_source_new (&hev_event_source_timeout_funcs,
 				sizeof (HevEventSourceTimeout));
-	if (NULL == source) {
-		close (fd);
+	if (NULL == source)
+	  return NULL;
+
+	/* no timerfd, the loop's timer wheel makes this fd ready */
+	fd = hev_event_source_add_fd (source, -1, EPOLLIN);
+	if (NULL == fd) {
+		hev_event_source_unref (source);
 		return NULL;
 	}
 
 	self = (HevEventSourceTimeout *) source;
-	self->timer_fd = fd;
+	hev_timer_wheel_entry_init (&self->timer, fd);
+	self->mode = mode;
 	self->interval = interval;
-	hev_event_source_add_fd (source, self->timer_fd, EPOLLIN | EPOLLET);
+	self->deadline = 0;
+	self->overruns = 0;
+	self->slack = 0;
+	/* a period of 0 would never end, a deadline of 0 is not set yet */
+	if ((HEV_EVENT_SOURCE_TIMEOUT_RELATIVE != mode) && !interval)
+	  self->interval = 1;
 
 	return source;
 }
 
+uint64_t
+hev_event_source_timeout_get_overruns (HevEventSource *source)
+{
+	HevEventSourceTimeout *self = (HevEventSourceTimeout *) source;
+
+	return self->overruns;
+}
+
+void
+hev_event_source_timeout_set_slack (HevEventSource *source, uint64_t slack)
+{
+	HevEventSourceTimeout *self = (HevEventSourceTimeout *) source;
+
+	self->slack = slack;
+}
+
+uint64_t
+hev_event_source_timeout_get_slack (HevEventSource *source)
+{
+	HevEventSourceTimeout *self = (HevEventSourceTimeout *) source;
+
+	return self->slack;
+}
+
 static bool
 hev_event_source_timeout_prepare (HevEventSource *source)
 {
 	HevEventSourceTimeout *self = (HevEventSourceTimeout *) source;
-	struct itimerspec spec;
+	HevEventLoop *loop = hev_event_source_get_loop (source);
+
+	switch (self->mode) {
+	case HEV_EVENT_SOURCE_TIMEOUT_PERIODIC:
+		/* later ones were moved on by check, from the previous deadline */
+		if (self->deadline)
+		  break;
+		/* fall through */
+	case HEV_EVENT_SOURCE_TIMEOUT_RELATIVE:
+		self->deadline = hev_event_loop_now_ns (loop) + self->interval;
+		break;
+	case HEV_EVENT_SOURCE_TIMEOUT_ABSOLUTE:
+		/* fired already */
+		if (self->deadline)
+		  return true;
+		self->deadline = self->interval;
+		break;
+	}
 
-	spec.it_interval.tv_sec = 0;
-	spec.it_interval.tv_nsec = 0;
-	spec.it_value.tv_sec = self->interval / 1000;
-	spec.it_value.tv_nsec = (self->interval % 1000) * 1000 * 1000;
-	timerfd_settime (self->timer_fd, 0, &spec, NULL);
+	_hev_event_loop_add_timer (loop, &self->timer, self->deadline, self->slack);
 
 	return true;
 }
@@ -106,13 +132,16 @@ static bool
 hev_event_source_timeout_check (HevEventSource *source, HevEventSourceFD *fd)
 {
 	HevEventSourceTimeout *self = (HevEventSourceTimeout *) source;
+
 	if (EPOLLIN & fd->revents) {
-		uint64_t time;
-		int size = read (self->timer_fd, &time, sizeof (uint64_t));
-		if (-1 == size) {
-			if (EAGAIN == errno)
-			  fd->revents &= ~EPOLLIN;
-			return false;
+		fd->revents &= ~EPOLLIN;
+		if (HEV_EVENT_SOURCE_TIMEOUT_PERIODIC == self->mode) {
+			uint64_t now = hev_event_loop_now_ns (hev_event_source_get_loop (source));
+
+			self->overruns = 0;
+			if (now > self->deadline)
+			  self->overruns = (now - self->deadline) / self->interval;
+			self->deadline += (self->overruns + 1) * self->interval;
 		}
 		return true;
 	}
@@ -124,6 +153,8 @@ static void
 hev_event_source_timeout_finalize (HevEventSource *source)
 {
 	HevEventSourceTimeout *self = (HevEventSourceTimeout *) source;
-	close (self->timer_fd);
+
+	if (hev_timer_wheel_entry_is_pending (&self->timer))
+	  hev_timer_wheel_del (self->timer._wheel, &self->timer);
 }
 
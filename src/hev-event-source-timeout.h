@@ -12,9 +12,34 @@
 #ifndef __HEV_EVENT_SOURCE_TIMEOUT_H__
 #define __HEV_EVENT_SOURCE_TIMEOUT_H__
 
+#include <stdint.h>
+
 typedef struct _HevEventSourceTimeout HevEventSourceTimeout;
+typedef enum _HevEventSourceTimeoutMode HevEventSourceTimeoutMode;
+
+enum _HevEventSourceTimeoutMode
+{
+	/* again interval after each dispatch, the default */
+	HEV_EVENT_SOURCE_TIMEOUT_RELATIVE,
+	/* every interval from when it is added, without drifting */
+	HEV_EVENT_SOURCE_TIMEOUT_PERIODIC,
+	/* once, when the loop's clock (hev_event_loop_now_ns) reaches interval */
+	HEV_EVENT_SOURCE_TIMEOUT_ABSOLUTE,
+};
 
+/* interval in ms, relative */
 HevEventSource * hev_event_source_timeout_new (unsigned int interval);
+/* interval (or the deadline) in ns, timers have a 65.536 us resolution */
+HevEventSource * hev_event_source_timeout_new_full (uint64_t interval,
+			HevEventSourceTimeoutMode mode);
+
+/* Lets the timer fire up to slack ns late, at a time shared with other
+ * timers so that they take one wakeup, from when it is next set. */
+void hev_event_source_timeout_set_slack (HevEventSource *source, uint64_t slack);
+uint64_t hev_event_source_timeout_get_slack (HevEventSource *source);
+
+/* Periods missed before the one being dispatched, periodic mode only. */
+uint64_t hev_event_source_timeout_get_overruns (HevEventSource *source);
 
 #endif /* __HEV_EVENT_SOURCE_TIMEOUT_H__ */
 
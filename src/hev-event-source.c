@@ -26,6 +26,7 @@ hev_event_source_new (HevEventSourceFuncs *funcs, size_t struct_size)
 		if (self) {
 			self->name = NULL;
 			self->priority = 0;
+			self->budget = 0;
 			self->ref_count = 1;
 			if (funcs)
 			  memcpy (&self->funcs, funcs, sizeof (HevEventSourceFuncs));
@@ -42,6 +43,9 @@ hev_event_source_new (HevEventSourceFuncs *funcs, size_t struct_size)
 			self->callback.notify = NULL;
 			self->fds = NULL;
 			self->loop = NULL;
+			memset (&self->stats, 0, sizeof (self->stats));
+			self->_prev = NULL;
+			self->_next = NULL;
 			return self;
 		}
 	}
@@ -60,13 +64,6 @@ hev_event_source_ref (HevEventSource *self)
 	return NULL;
 }
 
-static void
-fds_free_handler (void *data)
-{
-	_hev_event_source_fd_clear_source (data);
-	_hev_event_source_fd_unref (data);
-}
-
 void
 hev_event_source_unref (HevEventSource *self)
 {
@@ -78,7 +75,12 @@ hev_event_source_unref (HevEventSource *self)
 			  HEV_MEMORY_ALLOCATOR_FREE (self->name);
 			if (self->callback.notify)
 			  self->callback.notify (self->callback.data);
-			hev_slist_free_notify (self->fds, fds_free_handler);
+			while (self->fds) {
+				HevEventSourceFD *fd = self->fds;
+				self->fds = fd->_next;
+				_hev_event_source_fd_clear_source (fd);
+				_hev_event_source_fd_unref (fd);
+			}
 			HEV_MEMORY_ALLOCATOR_FREE (self);
 		}
 	}
@@ -90,8 +92,9 @@ hev_event_source_set_name (HevEventSource *self, const char *name)
 	if (self && name) {
 		if (self->name)
 		  HEV_MEMORY_ALLOCATOR_FREE (self->name);
-		self->name = HEV_MEMORY_ALLOCATOR_ALLOC (strlen (name));
-		strcpy (self->name, name);
+		self->name = HEV_MEMORY_ALLOCATOR_ALLOC (strlen (name) + 1);
+		if (self->name)
+		  strcpy (self->name, name);
 	}
 }
 
@@ -114,6 +117,25 @@ hev_event_source_get_priority (HevEventSource *self)
 	return self ? self->priority : INT32_MAX;
 }
 
+void
+hev_event_source_set_budget (HevEventSource *self, unsigned int budget)
+{
+	if (self)
+	  self->budget = budget;
+}
+
+unsigned int
+hev_event_source_get_budget (HevEventSource *self)
+{
+	return self ? self->budget : 0;
+}
+
+const HevEventSourceStats *
+hev_event_source_get_stats (HevEventSource *self)
+{
+	return self ? &self->stats : NULL;
+}
+
 void
 hev_event_source_set_callback (HevEventSource *self, HevEventSourceFunc callback,
 			void *data, HevDestroyNotify notify)
@@ -129,19 +151,22 @@ HevEventSourceFD *
 hev_event_source_add_fd (HevEventSource *self, int fd, uint32_t events)
 {
 	if (self) {
-		HevSList *list = NULL;
-		for (list=self->fds; list; list=hev_slist_next (list)) {
-			HevEventSourceFD *efd = hev_slist_data (list);
+		HevEventSourceFD *efd = NULL;
+		/* deferred and io_uring adds are not checked by the loop now */
+		for (efd=self->fds; efd; efd=efd->_next) {
 			if (efd->fd == fd)
 			  return NULL;
 		}
-		HevEventSourceFD *efd = _hev_event_source_fd_new (self, fd, events);
+		efd = _hev_event_source_fd_new (self, fd, events);
 		if (efd) {
-			self->fds = hev_slist_prepend (self->fds, efd);
 			if (self->loop && !_hev_event_loop_add_fd (self->loop, efd)) {
 				_hev_event_source_fd_unref (efd);
-				efd = NULL;
+				return NULL;
 			}
+			efd->_next = self->fds;
+			if (self->fds)
+			  self->fds->_prev = efd;
+			self->fds = efd;
 			return efd;
 		}
 	}
@@ -153,29 +178,78 @@ bool
 hev_event_source_del_fd (HevEventSource *self, int fd)
 {
 	if (self) {
-		HevEventSourceFD *rfd = NULL;
-		HevSList *list = NULL, *prev = NULL;
-		for (list=self->fds; list; prev=list,list=hev_slist_next (list)) {
-			HevEventSourceFD *efd = hev_slist_data (list);
-			if (efd->fd == fd) {
-				rfd = efd;
-				break;
-			}
-		}
-		if (rfd) {
-			bool res = false;
-			self->fds = hev_slist_remove_next (self->fds, prev);
-			if (self->loop)
-			  res = _hev_event_loop_del_fd (self->loop, rfd);
-			_hev_event_source_fd_clear_source (rfd);
-			_hev_event_source_fd_unref (rfd);
-			return res;
+		HevEventSourceFD *efd = NULL;
+		for (efd=self->fds; efd; efd=efd->_next) {
+			if (efd->fd == fd)
+			  return hev_event_source_remove_fd (self, efd);
 		}
 	}
 
 	return false;
 }
 
+bool
+hev_event_source_remove_fd (HevEventSource *self, HevEventSourceFD *fd)
+{
+	bool res = false;
+
+	if (!self || !fd || (fd->source != self))
+	  return false;
+
+	if (fd->_prev)
+	  fd->_prev->_next = fd->_next;
+	else
+	  self->fds = fd->_next;
+	if (fd->_next)
+	  fd->_next->_prev = fd->_prev;
+	fd->_prev = NULL;
+	fd->_next = NULL;
+
+	if (self->loop)
+	  res = _hev_event_loop_del_fd (self->loop, fd);
+	_hev_event_source_fd_clear_source (fd);
+	_hev_event_source_fd_unref (fd);
+
+	return res;
+}
+
+bool
+hev_event_source_fd_set_events (HevEventSourceFD *self, uint32_t events)
+{
+	HevEventLoop *loop = hev_event_source_get_loop (self->source);
+
+	self->_events = events;
+	if (!loop)
+	  return true;
+
+	return _hev_event_loop_mod_fd (loop, self);
+}
+
+uint32_t
+hev_event_source_fd_get_events (HevEventSourceFD *self)
+{
+	return self->_events;
+}
+
+bool
+hev_event_source_fd_set_trigger (HevEventSourceFD *self,
+			HevEventSourceFDTrigger trigger)
+{
+	HevEventLoop *loop = hev_event_source_get_loop (self->source);
+
+	self->_trigger = trigger;
+	if (!loop)
+	  return true;
+
+	return _hev_event_loop_mod_fd (loop, self);
+}
+
+HevEventSourceFDTrigger
+hev_event_source_fd_get_trigger (HevEventSourceFD *self)
+{
+	return self->_trigger;
+}
+
 HevEventLoop *
 hev_event_source_get_loop (HevEventSource *self)
 {
@@ -185,7 +259,7 @@ hev_event_source_get_loop (HevEventSource *self)
 void
 _hev_event_source_set_loop (HevEventSource *self, HevEventLoop *loop)
 {
-	if (self && (!self->loop) && loop)
+	if (self && (!self->loop || !loop))
 	  self->loop = loop;
 }
 
@@ -17,10 +17,10 @@
 #include <stdbool.h>
 
 #include "hev-memory-allocator.h"
-#include "hev-slist.h"
 
 typedef struct _HevEventSource HevEventSource;
 typedef struct _HevEventSourceFuncs HevEventSourceFuncs;
+typedef struct _HevEventSourceStats HevEventSourceStats;
 typedef bool (*HevEventSourceFunc) (void *data);
 
 #include "hev-event-source-fd.h"
@@ -34,10 +34,20 @@ struct _HevEventSourceFuncs
 	void (*finalize) (HevEventSource *self);
 };
 
+/* Collected while the loop's stats are enabled. */
+struct _HevEventSourceStats
+{
+	uint64_t dispatches;
+	uint64_t check_failures;
+	uint64_t total_ns;
+	uint64_t max_ns;
+};
+
 struct _HevEventSource
 {
 	char *name;
 	int priority;
+	unsigned int budget;
 	unsigned int ref_count;
 
 	HevEventSourceFuncs funcs;
@@ -47,8 +57,12 @@ struct _HevEventSource
 		HevDestroyNotify notify;
 	} callback;
 
-	HevSList *fds;
+	HevEventSourceFD *fds;
 	HevEventLoop *loop;
+	HevEventSourceStats stats;
+
+	HevEventSource *_prev;
+	HevEventSource *_next;
 };
 
 HevEventSource * hev_event_source_new (HevEventSourceFuncs *funcs, size_t struct_size);
@@ -59,14 +73,29 @@ void hev_event_source_unref (HevEventSource *self);
 void hev_event_source_set_name (HevEventSource *self, const char *name);
 const char * hev_event_source_get_name (HevEventSource *self);
 
+/* Ready fds are dispatched from the highest priority down (see the loop's
+ * sched policy), priorities beyond [-32, 31] are treated as -32 or 31. */
 void hev_event_source_set_priority (HevEventSource *self, int priority);
 int hev_event_source_get_priority (HevEventSource *self);
 
+/* Times in a row a still ready fd of the source is dispatched before the
+ * other ready fds of its priority get their turn, 0 (default) is no limit. */
+void hev_event_source_set_budget (HevEventSource *self, unsigned int budget);
+unsigned int hev_event_source_get_budget (HevEventSource *self);
+
+const HevEventSourceStats * hev_event_source_get_stats (HevEventSource *self);
+
 void hev_event_source_set_callback (HevEventSource *self, HevEventSourceFunc callback,
 			void *data, HevDestroyNotify notify);
 
+/* NULL if the source has fd already, or the loop failed to watch it.
+ * With EPOLLEXCLUSIVE in events, of the loops watching the same fd (e.g.
+ * a shared listening socket) one or a few wake up for an event, not all,
+ * epoll backend only. Such fds are not oneshot and changing their events
+ * adds them to epoll again (see hev_event_source_fd_set_events). */
 HevEventSourceFD * hev_event_source_add_fd (HevEventSource *self, int fd, uint32_t events);
 bool hev_event_source_del_fd (HevEventSource *self, int fd);
+bool hev_event_source_remove_fd (HevEventSource *self, HevEventSourceFD *fd);
 
 HevEventLoop * hev_event_source_get_loop (HevEventSource *self);
 void _hev_event_source_set_loop (HevEventSource *self, HevEventLoop *loop);
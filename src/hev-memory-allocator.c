@@ -8,18 +8,30 @@
  */
 
 #include <string.h>
+#include <pthread.h>
 #include "hev-memory-allocator.h"
 
-static HevMemoryAllocator *default_allocator;
+/* every thread may set its own default, others share a malloc one */
+static __thread HevMemoryAllocator *default_allocator;
+static HevMemoryAllocator *shared_allocator;
+static pthread_once_t shared_allocator_once = PTHREAD_ONCE_INIT;
 
 static void * _hev_memory_allocator_alloc (HevMemoryAllocator *self, size_t size);
 static void _hev_memory_allocator_free (HevMemoryAllocator *self, void *ptr);
 
+static void
+shared_allocator_init (void)
+{
+	shared_allocator = hev_memory_allocator_new ();
+}
+
 HevMemoryAllocator *
 hev_memory_allocator_default (void)
 {
-	if (!default_allocator)
-	  default_allocator = hev_memory_allocator_new ();
+	if (!default_allocator) {
+		pthread_once (&shared_allocator_once, shared_allocator_init);
+		return shared_allocator;
+	}
 
 	return default_allocator;
 }
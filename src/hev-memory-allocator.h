@@ -34,6 +34,9 @@ struct _HevMemoryAllocator
 	unsigned int ref_count;
 };
 
+/* The default allocator is per thread, threads that never set one share
+ * a malloc based allocator. Memory must be freed by the allocator that
+ * allocated it. */
 HevMemoryAllocator * hev_memory_allocator_default (void);
 HevMemoryAllocator * hev_memory_allocator_set_default (HevMemoryAllocator *allocator);
 
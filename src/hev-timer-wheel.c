@@ -0,0 +1,269 @@
+/*
+ ============================================================================
+ Name        : hev-timer-wheel.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2013 everyone.
+ Description : Hierarchical timer wheel
+ ============================================================================
+ */
+
+#include <string.h>
+
+#include "hev-timer-wheel.h"
+#include "hev-memory-allocator.h"
+
+/* 4 levels of 64 slots, covers 2^24 ticks, farther entries are clamped
+ * to the last slot and placed again when they are cascaded. */
+#define LEVEL_BITS	(6)
+#define LEVEL_SIZE	(1 << LEVEL_BITS)
+#define LEVEL_MASK	(LEVEL_SIZE - 1)
+#define LEVEL_COUNT	(4)
+#define MAX_DELTA	(UINT64_C (1) << (LEVEL_BITS * LEVEL_COUNT))
+#define EXPIRED_SLOT	(LEVEL_SIZE * LEVEL_COUNT)
+
+struct _HevTimerWheel
+{
+	uint64_t current;
+	unsigned int count;
+	unsigned int ref_count;
+
+	uint64_t masks[LEVEL_COUNT];
+	/* slots of all levels, then the list being expired */
+	HevTimerWheelEntry *slots[LEVEL_SIZE * LEVEL_COUNT + 1];
+};
+
+HevTimerWheel *
+hev_timer_wheel_new (uint64_t now)
+{
+	HevTimerWheel *self = HEV_MEMORY_ALLOCATOR_ALLOC (sizeof (HevTimerWheel));
+
+	if (self) {
+		self->current = now;
+		self->count = 0;
+		self->ref_count = 1;
+		memset (self->masks, 0, sizeof (self->masks));
+		memset (self->slots, 0, sizeof (self->slots));
+	}
+
+	return self;
+}
+
+HevTimerWheel *
+hev_timer_wheel_ref (HevTimerWheel *self)
+{
+	if (self) {
+		self->ref_count ++;
+		return self;
+	}
+
+	return NULL;
+}
+
+void
+hev_timer_wheel_unref (HevTimerWheel *self)
+{
+	unsigned int i;
+
+	if (!self)
+	  return;
+
+	self->ref_count --;
+	if (0 < self->ref_count)
+	  return;
+
+	/* detach pending entries, their owners may outlive the wheel */
+	for (i=0; i<=EXPIRED_SLOT; i++) {
+		while (self->slots[i]) {
+			HevTimerWheelEntry *entry = self->slots[i];
+			self->slots[i] = entry->_next;
+			entry->_wheel = NULL;
+			entry->_prev = NULL;
+			entry->_next = NULL;
+		}
+	}
+	HEV_MEMORY_ALLOCATOR_FREE (self);
+}
+
+static inline void
+slot_insert (HevTimerWheel *self, HevTimerWheelEntry *entry, unsigned int slot)
+{
+	HevTimerWheelEntry **head = &self->slots[slot];
+
+	entry->_wheel = self;
+	entry->_slot = slot;
+	entry->_prev = NULL;
+	entry->_next = *head;
+	if (*head)
+	  (*head)->_prev = entry;
+	*head = entry;
+	if (EXPIRED_SLOT != slot)
+	  self->masks[slot >> LEVEL_BITS] |= (UINT64_C (1) << (slot & LEVEL_MASK));
+}
+
+static inline void
+slot_remove (HevTimerWheel *self, HevTimerWheelEntry *entry)
+{
+	unsigned int slot = entry->_slot;
+
+	if (entry->_prev)
+	  entry->_prev->_next = entry->_next;
+	else
+	  self->slots[slot] = entry->_next;
+	if (entry->_next)
+	  entry->_next->_prev = entry->_prev;
+	if (!self->slots[slot] && (EXPIRED_SLOT != slot))
+	  self->masks[slot >> LEVEL_BITS] &= ~(UINT64_C (1) << (slot & LEVEL_MASK));
+	entry->_wheel = NULL;
+	entry->_prev = NULL;
+	entry->_next = NULL;
+}
+
+static void
+place_entry (HevTimerWheel *self, HevTimerWheelEntry *entry)
+{
+	uint64_t expires = entry->expires;
+	uint64_t delta = 0;
+	unsigned int level = 0;
+
+	if (expires < self->current)
+	  expires = self->current;
+	delta = expires - self->current;
+	if (delta >= MAX_DELTA) {
+		delta = MAX_DELTA - 1;
+		expires = self->current + delta;
+	}
+	while (delta >= (UINT64_C (1) << (LEVEL_BITS * (level + 1))))
+	  level ++;
+
+	slot_insert (self, entry, (level << LEVEL_BITS) |
+				((expires >> (LEVEL_BITS * level)) & LEVEL_MASK));
+}
+
+void
+hev_timer_wheel_add (HevTimerWheel *self, HevTimerWheelEntry *entry, uint64_t expires)
+{
+	if (entry->_wheel)
+	  hev_timer_wheel_del (entry->_wheel, entry);
+
+	entry->expires = expires;
+	place_entry (self, entry);
+	self->count ++;
+}
+
+void
+hev_timer_wheel_del (HevTimerWheel *self, HevTimerWheelEntry *entry)
+{
+	if (!self || (entry->_wheel != self))
+	  return;
+
+	slot_remove (self, entry);
+	self->count --;
+}
+
+unsigned int
+hev_timer_wheel_get_count (HevTimerWheel *self)
+{
+	return self->count;
+}
+
+/* The first tick not before current at which a non-empty slot is due:
+ * a level 0 slot expires, or a higher level slot is cascaded down. */
+static uint64_t
+next_event (HevTimerWheel *self)
+{
+	uint64_t next = UINT64_MAX;
+	unsigned int level;
+
+	for (level=0; level<LEVEL_COUNT; level++) {
+		unsigned int shift = LEVEL_BITS * level;
+		uint64_t mask = self->masks[level];
+		uint64_t base = self->current >> shift;
+		uint64_t tick;
+		unsigned int digit;
+
+		if (!mask)
+		  continue;
+
+		/* a level is only cascaded on its own boundaries */
+		if (self->current & ((UINT64_C (1) << shift) - 1))
+		  base ++;
+		digit = base & LEVEL_MASK;
+		if (digit)
+		  mask = (mask >> digit) | (mask << (LEVEL_SIZE - digit));
+		tick = (base + __builtin_ctzll (mask)) << shift;
+		if (tick < next)
+		  next = tick;
+	}
+
+	return next;
+}
+
+int64_t
+hev_timer_wheel_get_timeout (HevTimerWheel *self, uint64_t now)
+{
+	uint64_t next;
+
+	if (!self->count)
+	  return -1;
+
+	next = next_event (self);
+	return (next > now) ? (int64_t) (next - now) : 0;
+}
+
+static void
+cascade (HevTimerWheel *self, unsigned int level)
+{
+	unsigned int slot = (level << LEVEL_BITS) |
+		((self->current >> (LEVEL_BITS * level)) & LEVEL_MASK);
+
+	while (self->slots[slot]) {
+		HevTimerWheelEntry *entry = self->slots[slot];
+		slot_remove (self, entry);
+		place_entry (self, entry);
+	}
+}
+
+unsigned int
+hev_timer_wheel_advance (HevTimerWheel *self, uint64_t now,
+			HevTimerWheelFunc func, void *data)
+{
+	unsigned int expired = 0;
+
+	while (self->count) {
+		unsigned int level, slot;
+		uint64_t next = next_event (self);
+
+		if (next > now)
+		  break;
+
+		self->current = next;
+		for (level=1; level<LEVEL_COUNT; level++) {
+			if (self->current & ((UINT64_C (1) << (LEVEL_BITS * level)) - 1))
+			  break;
+			cascade (self, level);
+		}
+
+		/* move due entries aside, entries added by func go to later ticks */
+		slot = self->current & LEVEL_MASK;
+		while (self->slots[slot]) {
+			HevTimerWheelEntry *entry = self->slots[slot];
+			slot_remove (self, entry);
+			slot_insert (self, entry, EXPIRED_SLOT);
+		}
+		self->current ++;
+
+		while (self->slots[EXPIRED_SLOT]) {
+			HevTimerWheelEntry *entry = self->slots[EXPIRED_SLOT];
+			slot_remove (self, entry);
+			self->count --;
+			expired ++;
+			func (entry, data);
+		}
+	}
+
+	if (self->current <= now)
+	  self->current = now + 1;
+
+	return expired;
+}
+
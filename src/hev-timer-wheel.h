@@ -0,0 +1,68 @@
+/*
+ ============================================================================
+ Name        : hev-timer-wheel.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2013 everyone.
+ Description : Hierarchical timer wheel
+ ============================================================================
+ */
+
+#ifndef __HEV_TIMER_WHEEL_H__
+#define __HEV_TIMER_WHEEL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct _HevTimerWheel HevTimerWheel;
+typedef struct _HevTimerWheelEntry HevTimerWheelEntry;
+typedef void (*HevTimerWheelFunc) (HevTimerWheelEntry *entry, void *data);
+
+/* Entries are embedded by the user, expires is counted in ticks. */
+struct _HevTimerWheelEntry
+{
+	uint64_t expires;
+	/* for the user, e.g. the tick asked for before slack delayed it */
+	uint64_t deadline;
+	void *data;
+
+	HevTimerWheel *_wheel;
+	HevTimerWheelEntry *_prev;
+	HevTimerWheelEntry *_next;
+	unsigned int _slot;
+};
+
+HevTimerWheel * hev_timer_wheel_new (uint64_t now);
+
+HevTimerWheel * hev_timer_wheel_ref (HevTimerWheel *self);
+void hev_timer_wheel_unref (HevTimerWheel *self);
+
+static inline void
+hev_timer_wheel_entry_init (HevTimerWheelEntry *entry, void *data)
+{
+	entry->expires = 0;
+	entry->deadline = 0;
+	entry->data = data;
+	entry->_wheel = NULL;
+	entry->_prev = NULL;
+	entry->_next = NULL;
+	entry->_slot = 0;
+}
+
+static inline bool
+hev_timer_wheel_entry_is_pending (HevTimerWheelEntry *entry)
+{
+	return entry->_wheel ? true : false;
+}
+
+void hev_timer_wheel_add (HevTimerWheel *self, HevTimerWheelEntry *entry, uint64_t expires);
+void hev_timer_wheel_del (HevTimerWheel *self, HevTimerWheelEntry *entry);
+
+unsigned int hev_timer_wheel_get_count (HevTimerWheel *self);
+/* Ticks from now to the next expiry or cascade, -1 if empty. */
+int64_t hev_timer_wheel_get_timeout (HevTimerWheel *self, uint64_t now);
+/* Run func for every entry expired at now, returns the number expired. */
+unsigned int hev_timer_wheel_advance (HevTimerWheel *self, uint64_t now,
+			HevTimerWheelFunc func, void *data);
+
+#endif /* __HEV_TIMER_WHEEL_H__ */
+